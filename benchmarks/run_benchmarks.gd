@@ -0,0 +1,152 @@
+# Runs voxel benchmarks and saves results as JSON.
+# Meant for the server platform, which has no renderer, so results only depend on the module:
+#
+#   godot_server --script modules/voxel/benchmarks/run_benchmarks.gd --output=results.json
+#
+# Options: --output=<path>, --iterations=<count>, --frames=<count>, --skip-micro, --skip-flythrough
+extends SceneTree
+
+const Stats = preload("stats.gd")
+
+const VIEW_DISTANCE = 128
+# Fixed movement per frame instead of using delta, so every run asks for the same blocks in the same order
+const VIEWER_SPEED = 0.5
+# After the path ended, frames left for pending blocks to finish
+const MAX_SETTLE_FRAMES = 3000
+
+var _options = {
+	"output": "voxel_benchmark_results.json",
+	"iterations": 100,
+	"frames": 1200
+}
+var _skip_micro = false
+var _skip_flythrough = false
+
+var _results = {}
+var _terrain = null
+var _viewer_id = -1
+var _frame = 0
+var _settle_frames = 0
+var _frame_times = []
+var _last_frame_time = 0
+var _begin_time = 0
+
+
+func _initialize():
+	for arg in OS.get_cmdline_args():
+		if arg == "--skip-micro":
+			_skip_micro = true
+		elif arg == "--skip-flythrough":
+			_skip_flythrough = true
+		elif arg.begins_with("--") and arg.find("=") != -1:
+			var key = arg.substr(2, arg.find("=") - 2)
+			if _options.has(key):
+				var value = arg.substr(arg.find("=") + 1, arg.length())
+				_options[key] = value if key == "output" else int(value)
+
+	if not _skip_micro:
+		print("Running microbenchmarks...")
+		var benchmark = VoxelBenchmark.new()
+		benchmark.iterations = _options.iterations
+		_results["micro"] = benchmark.run_all()
+
+	if _skip_flythrough:
+		_finish()
+	else:
+		print("Running fly-through...")
+		_start_flythrough()
+
+
+func _start_flythrough():
+	VoxelPerformance.reset_peaks()
+
+	var library = VoxelLibrary.new()
+	library.create_voxel(0, "air").set_transparent(true)
+	library.create_voxel(1, "solid").set_transparent(false).set_geometry_type(Voxel.GEOMETRY_CUBE)
+
+	var provider = VoxelProviderTest.new()
+	provider.mode = VoxelProviderTest.MODE_WAVES
+	provider.pattern_size = Vector3(30, 10, 30)
+
+	_terrain = VoxelTerrain.new()
+	_terrain.voxel_library = library
+	_terrain.provider = provider
+	_terrain.view_distance = VIEW_DISTANCE
+	_viewer_id = _terrain.add_viewer(_get_viewer_position(0), VIEW_DISTANCE)
+	get_root().add_child(_terrain)
+
+	_begin_time = OS.get_ticks_usec()
+	_last_frame_time = _begin_time
+
+
+# Goes straight, then turns around a circle, which exercises both loading ahead and unloading behind
+static func _get_viewer_position(frame):
+	var d = frame * VIEWER_SPEED
+	var straight = 200.0
+	if d < straight:
+		return Vector3(d, 20, 0)
+	var radius = 100.0
+	var a = (d - straight) / radius
+	return Vector3(straight + radius * sin(a), 20, radius - radius * cos(a))
+
+
+func _idle(delta):
+	if _terrain == null:
+		return false
+
+	var now = OS.get_ticks_usec()
+	_frame_times.append(now - _last_frame_time)
+	_last_frame_time = now
+
+	if _frame < _options.frames:
+		_frame += 1
+		_terrain.set_viewer_position(_viewer_id, _get_viewer_position(_frame))
+		return false
+
+	var pending = VoxelPerformance.get_monitor(VoxelPerformance.BLOCKS_PENDING_LOAD) \
+			+ VoxelPerformance.get_monitor(VoxelPerformance.BLOCKS_PENDING_MESH) \
+			+ VoxelPerformance.get_monitor(VoxelPerformance.BLOCKS_PENDING_MAIN_THREAD)
+
+	if pending > 0 and _settle_frames < MAX_SETTLE_FRAMES:
+		_settle_frames += 1
+		return false
+
+	_results["flythrough"] = _get_flythrough_results(now - _begin_time, pending)
+	_terrain.queue_free()
+	_terrain = null
+	_finish()
+	return true
+
+
+func _get_flythrough_results(total_time, pending):
+	var blocks_loaded = VoxelPerformance.get_monitor(VoxelPerformance.BLOCKS_LOADED)
+	var seconds = max(total_time, 1) / 1000000.0
+	return {
+		"frames": _frame,
+		"settle_frames": _settle_frames,
+		"unfinished_blocks": pending,
+		"total_usec": total_time,
+		"blocks_loaded": blocks_loaded,
+		"blocks_per_second": blocks_loaded / seconds,
+		"frame_usec": Stats.get_percentiles(_frame_times),
+		"block_latency": _terrain.get_latency_statistics(),
+		"memory": {
+			"channel_memory_peak": VoxelPerformance.get_monitor(VoxelPerformance.CHANNEL_MEMORY_PEAK),
+			"mesh_memory": VoxelPerformance.get_monitor(VoxelPerformance.MESH_MEMORY),
+			"static_memory_peak": OS.get_static_memory_peak_usage()
+		}
+	}
+
+
+func _finish():
+	var json = to_json(_results)
+	var f = File.new()
+	if f.open(_options.output, File.WRITE) == OK:
+		f.store_string(json)
+		f.close()
+		print("Results saved to ", _options.output)
+	else:
+		printerr("Could not write ", _options.output)
+	print(json)
+	if _terrain == null:
+		quit()
@@ -0,0 +1,288 @@
+# Stress test for the streaming threads, meant to run for a long time with the server platform:
+#
+#   godot_server --script modules/voxel/benchmarks/soak.gd --minutes=120 --output=soak.json
+#
+# Options: --output=<path>, --minutes=<duration>, --seed=<seed>, --interval=<frames per report>
+#
+# Viewers move around randomly while view distances change, the voxel library gets swapped and voxels are edited in bursts.
+# Actions are chosen from the seed and the frame number, so a failing run can be replayed with the same seed.
+# Each interval reports throughput and latency percentiles, so it can be seen if they drift over time.
+#
+# At the end, edits stop and the terrain has to settle: no block may remain waiting for a thread,
+# and once the terrain is freed, voxel memory must go back to what it was before.
+# Exits with code 1 if any of that fails.
+#
+# To look for data races, run it with a build made with ThreadSanitizer, for example:
+#   scons platform=server target=debug CCFLAGS=-fsanitize=thread LINKFLAGS=-fsanitize=thread
+extends SceneTree
+
+const Stats = preload("stats.gd")
+
+const VIEWER_COUNT = 3
+const MIN_VIEW_DISTANCE = 64
+const MAX_VIEW_DISTANCE = 192
+const WORLD_EXTENT = 2000.0
+const MAX_SETTLE_FRAMES = 6000
+
+enum Phase {
+	PHASE_STRESS,
+	PHASE_SETTLE,
+	PHASE_CHECK_LEAKS
+}
+
+var _options = {
+	"output": "voxel_soak_results.json",
+	"minutes": 10,
+	"seed": 1337,
+	"interval": 600
+}
+
+var _phase = PHASE_STRESS
+var _terrain = null
+var _libraries = []
+var _viewers = []
+var _frame = 0
+var _phase_frames = 0
+var _begin_time = 0
+var _end_time = 0
+
+var _baseline = {}
+var _intervals = []
+var _interval_frame_times = []
+var _interval_begin_time = 0
+var _last_frame_time = 0
+var _edit_count = 0
+var _library_swaps = 0
+var _errors = []
+
+
+func _initialize():
+	for arg in OS.get_cmdline_args():
+		if arg.begins_with("--") and arg.find("=") != -1:
+			var key = arg.substr(2, arg.find("=") - 2)
+			if _options.has(key):
+				var value = arg.substr(arg.find("=") + 1, arg.length())
+				_options[key] = value if key == "output" else int(value)
+
+	seed(_options.seed)
+
+	_baseline = _get_monitors()
+
+	for i in 2:
+		var library = VoxelLibrary.new()
+		library.create_voxel(0, "air").set_transparent(true)
+		library.create_voxel(1, "solid").set_transparent(false).set_geometry_type(Voxel.GEOMETRY_CUBE)
+		library.create_voxel(2, "glass").set_transparent(true).set_geometry_type(Voxel.GEOMETRY_CUBE if i == 0 else Voxel.GEOMETRY_NONE)
+		_libraries.append(library)
+
+	var provider = VoxelProviderTest.new()
+	provider.mode = VoxelProviderTest.MODE_WAVES
+	provider.pattern_size = Vector3(40, 16, 40)
+
+	_terrain = VoxelTerrain.new()
+	_terrain.voxel_library = _libraries[0]
+	_terrain.provider = provider
+	_terrain.generate_collisions = true
+	_terrain.low_latency_edit_distance = 64
+
+	for i in VIEWER_COUNT:
+		var pos = _random_position()
+		var id = _terrain.add_viewer(pos, MIN_VIEW_DISTANCE)
+		_viewers.append({ "id": id, "position": pos, "target": _random_position() })
+
+	get_root().add_child(_terrain)
+
+	_begin_time = OS.get_ticks_usec()
+	_end_time = _begin_time + _options.minutes * 60 * 1000000
+	_interval_begin_time = _begin_time
+	_last_frame_time = _begin_time
+	print("Soak test running for ", _options.minutes, " minutes with seed ", _options.seed)
+
+
+func _idle(delta):
+	var now = OS.get_ticks_usec()
+	_interval_frame_times.append(now - _last_frame_time)
+	_last_frame_time = now
+	_frame += 1
+	_phase_frames += 1
+
+	match _phase:
+		PHASE_STRESS:
+			_stress()
+			if _frame % _options.interval == 0:
+				_report_interval(now)
+			if now >= _end_time:
+				_report_interval(now)
+				_set_phase(PHASE_SETTLE)
+
+		PHASE_SETTLE:
+			var stats = _terrain.get_statistics()
+			var waiting = stats.blocks_loading + stats.blocks_update_not_sent + stats.blocks_update_sent
+			if waiting == 0 and _get_pending_count() == 0:
+				print("Settled after ", _phase_frames, " frames")
+				_terrain.queue_free()
+				_terrain = null
+				_set_phase(PHASE_CHECK_LEAKS)
+			elif _phase_frames > MAX_SETTLE_FRAMES:
+				_errors.append("Blocks still waiting after %d frames: %d loading, %d update not sent, %d update sent" % [
+						_phase_frames, stats.blocks_loading, stats.blocks_update_not_sent, stats.blocks_update_sent])
+				_terrain.queue_free()
+				_terrain = null
+				_set_phase(PHASE_CHECK_LEAKS)
+
+		PHASE_CHECK_LEAKS:
+			# Give time to the terrain to be freed
+			if _phase_frames < 10:
+				return false
+			_check_leaks()
+			_finish()
+			return true
+
+	return false
+
+
+func _set_phase(phase):
+	_phase = phase
+	_phase_frames = 0
+
+
+func _stress():
+	# Viewers go from one random target to another, sometimes teleporting
+	for viewer in _viewers:
+		if randi() % 2000 == 0:
+			viewer.position = _random_position()
+		var to_target = viewer.target - viewer.position
+		if to_target.length() < 4.0:
+			viewer.target = _random_position()
+		else:
+			viewer.position += to_target.normalized() * rand_range(0.5, 4.0)
+		_terrain.set_viewer_position(viewer.id, viewer.position)
+
+		if randi() % 300 == 0:
+			_terrain.set_viewer_view_distance(viewer.id, int(rand_range(MIN_VIEW_DISTANCE, MAX_VIEW_DISTANCE)))
+
+	if randi() % 3000 == 0:
+		_library_swaps += 1
+		_terrain.voxel_library = _libraries[_library_swaps % _libraries.size()]
+
+	# Bursts of edits around a viewer, in one or many transactions
+	if randi() % 60 == 0:
+		var center = _viewers[randi() % _viewers.size()].position
+		var burst_size = 1 + randi() % 50
+		var transaction = randi() % 2 == 0
+		if transaction:
+			_terrain.begin_edit()
+		for i in burst_size:
+			var pos = center + Vector3(rand_range(-32, 32), rand_range(-16, 16), rand_range(-32, 32))
+			if randi() % 2 == 0:
+				_terrain.do_sphere(pos, rand_range(1, 6), randi() % 3)
+			else:
+				_terrain.do_box(pos, pos + Vector3(1 + randi() % 8, 1 + randi() % 8, 1 + randi() % 8), randi() % 3)
+			_edit_count += 1
+		if transaction:
+			_terrain.end_edit()
+
+
+func _random_position():
+	return Vector3(rand_range(-WORLD_EXTENT, WORLD_EXTENT), rand_range(-20, 40), rand_range(-WORLD_EXTENT, WORLD_EXTENT))
+
+
+static func _get_monitors():
+	var monitors = {}
+	for i in VoxelPerformance.MONITOR_MAX:
+		monitors[VoxelPerformance.get_monitor_name(i)] = VoxelPerformance.get_monitor(i)
+	return monitors
+
+
+static func _get_pending_count():
+	return VoxelPerformance.get_monitor(VoxelPerformance.BLOCKS_PENDING_LOAD) \
+			+ VoxelPerformance.get_monitor(VoxelPerformance.BLOCKS_PENDING_MESH) \
+			+ VoxelPerformance.get_monitor(VoxelPerformance.BLOCKS_PENDING_MAIN_THREAD)
+
+
+func _report_interval(now):
+	var seconds = max(now - _interval_begin_time, 1) / 1000000.0
+	# The number of loaded blocks goes up and down, so throughput is counted from completed loads
+	var latency = _terrain.get_latency_statistics()
+	var blocks_shown = latency.total.count
+	var interval = {
+		"frame": _frame,
+		"elapsed_seconds": (now - _begin_time) / 1000000.0,
+		"blocks_shown_per_second": blocks_shown / seconds,
+		"frame_usec": Stats.get_percentiles(_interval_frame_times),
+		"latency": latency,
+		"monitors": _get_monitors(),
+		"edits": _edit_count,
+		"library_swaps": _library_swaps
+	}
+	_intervals.append(interval)
+	print("[%d s] %d blocks/s, frame p99 %d us, block p99 %d us" % [
+			interval.elapsed_seconds, interval.blocks_shown_per_second, interval.frame_usec.p99, latency.total.p99])
+
+	_terrain.reset_latency_statistics()
+	_interval_frame_times.clear()
+	_interval_begin_time = now
+
+
+func _check_leaks():
+	var monitors = _get_monitors()
+	for key in ["voxel/blocks_loaded", "voxel/channel_memory", "voxel/mesh_vertices", "voxel/mesh_memory"]:
+		if monitors.has(key) and monitors[key] != _baseline[key]:
+			_errors.append("%s is %d after the terrain was freed, it was %d before" % [key, monitors[key], _baseline[key]])
+	for key in ["voxel/blocks_pending_load", "voxel/blocks_pending_mesh", "voxel/blocks_pending_main_thread"]:
+		if monitors.has(key) and monitors[key] != 0:
+			_errors.append("%s is %d after the terrain was freed" % [key, monitors[key]])
+
+
+# Throughput stability, as the spread of per-interval throughputs relative to their mean
+func _get_stability():
+	var values = []
+	for interval in _intervals:
+		values.append(interval.blocks_shown_per_second)
+	if values.size() == 0:
+		return {}
+	var mean = 0.0
+	for v in values:
+		mean += v
+	mean /= values.size()
+	var variance = 0.0
+	for v in values:
+		variance += (v - mean) * (v - mean)
+	variance /= values.size()
+	return {
+		"mean_blocks_per_second": mean,
+		"min_blocks_per_second": _array_min(values),
+		"coefficient_of_variation": sqrt(variance) / mean if mean > 0 else 0.0
+	}
+
+
+static func _array_min(values):
+	var m = values[0]
+	for v in values:
+		m = min(m, v)
+	return m
+
+
+func _finish():
+	var results = {
+		"seed": _options.seed,
+		"minutes": _options.minutes,
+		"frames": _frame,
+		"edits": _edit_count,
+		"library_swaps": _library_swaps,
+		"stability": _get_stability(),
+		"intervals": _intervals,
+		"errors": _errors,
+		"passed": _errors.empty()
+	}
+
+	var f = File.new()
+	if f.open(_options.output, File.WRITE) == OK:
+		f.store_string(to_json(results))
+		f.close()
+		print("Results saved to ", _options.output)
+
+	for e in _errors:
+		printerr(e)
+	print("PASSED" if _errors.empty() else "FAILED")
+	OS.exit_code = 0 if _errors.empty() else 1
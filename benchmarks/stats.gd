@@ -0,0 +1,21 @@
+# Statistics shared by benchmark scripts
+
+
+static func get_percentiles(values):
+	if values.size() == 0:
+		return {}
+	var sorted = values.duplicate()
+	sorted.sort()
+	var total = 0
+	for v in sorted:
+		total += v
+	var last = sorted.size() - 1
+	return {
+		"count": sorted.size(),
+		"min": sorted[0],
+		"max": sorted[last],
+		"mean": total / sorted.size(),
+		"p50": sorted[int(last * 0.50)],
+		"p95": sorted[int(last * 0.95)],
+		"p99": sorted[int(last * 0.99)]
+	}
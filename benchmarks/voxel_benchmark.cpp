@@ -0,0 +1,432 @@
+#include "voxel_benchmark.h"
+#include "../transvoxel/voxel_mesher_smooth.h"
+#include "../voxel_buffer.h"
+#include "../voxel_latency_histogram.h"
+#include "../voxel_library.h"
+#include "../voxel_map.h"
+#include "../voxel_mesher.h"
+#include "../voxel_performance.h"
+#include "../voxel_simd.h"
+#include "../voxel_terrain.h"
+
+#include <core/math/random_pcg.h>
+#include <core/os/os.h>
+
+// Runs `f` the given number of times and reports how long it took, in microseconds.
+// `items` is how many things one run processes (voxels, rays...), to compute a throughput.
+template <typename F>
+static Dictionary measure(int iterations, uint64_t items, F f) {
+
+	VoxelLatencyHistogram histogram;
+	OS &os = *OS::get_singleton();
+
+	const uint64_t begin_time = os.get_ticks_usec();
+	for (int i = 0; i < iterations; ++i) {
+		const uint64_t time_before = os.get_ticks_usec();
+		f(i);
+		histogram.add(os.get_ticks_usec() - time_before);
+	}
+	const uint64_t total_time = os.get_ticks_usec() - begin_time;
+
+	Dictionary d;
+	d["iterations"] = iterations;
+	d["total_usec"] = total_time;
+	d["items_per_second"] = total_time > 0 ? double(items) * iterations * 1000000.0 / double(total_time) : 0.0;
+	d["usec"] = histogram.to_dictionary();
+	return d;
+}
+
+// Rolling hills with ground below, in both the type and isolevel channels
+static void generate_block(VoxelBuffer &buffer, Vector3i origin) {
+
+	const Vector3i size = buffer.get_size();
+
+	for (int z = 0; z < size.z; ++z) {
+		for (int x = 0; x < size.x; ++x) {
+
+			const int gx = origin.x + x;
+			const int gz = origin.z + z;
+			const real_t height = 6.0 * (Math::sin(gx * 0.11) + Math::cos(gz * 0.07)) + 2.0 * Math::sin((gx + gz) * 0.31);
+
+			for (int y = 0; y < size.y; ++y) {
+				// Negative isolevels are matter
+				const real_t d = origin.y + y - height;
+				buffer.set_voxel(d < 0 ? 1 : 0, x, y, z, Voxel::CHANNEL_TYPE);
+				buffer.set_voxel_iso(CLAMP(d * 0.25, -1.0, 1.0), x, y, z, Voxel::CHANNEL_ISOLEVEL);
+			}
+		}
+	}
+}
+
+static uint64_t get_surfaces_checksum(const Array &surfaces) {
+	uint64_t sum = 0;
+	for (int i = 0; i < surfaces.size(); ++i) {
+		const Array arrays = surfaces[i];
+		if (arrays.size() > Mesh::ARRAY_VERTEX) {
+			const PoolVector3Array positions = arrays[Mesh::ARRAY_VERTEX];
+			sum += positions.size();
+		}
+	}
+	return sum;
+}
+
+VoxelBenchmark::VoxelBenchmark() {
+	_iterations = 100;
+	_seed = 131183;
+	_checksum = 0;
+}
+
+void VoxelBenchmark::set_iterations(int iterations) {
+	ERR_FAIL_COND(iterations < 1);
+	_iterations = iterations;
+}
+
+void VoxelBenchmark::set_seed(int seed) {
+	_seed = seed;
+}
+
+Dictionary VoxelBenchmark::run_buffer_benchmarks() {
+
+	const int size = 64;
+	const uint64_t volume = size * size * size;
+
+	Ref<VoxelBuffer> buffer_ref;
+	buffer_ref.instance();
+	VoxelBuffer &buffer = **buffer_ref;
+	buffer.create(size, size, size);
+
+	Ref<VoxelBuffer> other_ref;
+	other_ref.instance();
+	VoxelBuffer &other = **other_ref;
+	other.create(size, size, size);
+	generate_block(other, Vector3i(0, -size / 2, 0));
+
+	Dictionary results;
+
+	// Makes sure filling writes memory instead of just changing the uniform value
+	buffer.decompress_channel(Voxel::CHANNEL_TYPE);
+	results["fill"] = measure(_iterations, volume, [&](int i) {
+		buffer.fill(i & 0xff, Voxel::CHANNEL_TYPE);
+	});
+
+	results["copy"] = measure(_iterations, volume, [&](int i) {
+		buffer.copy_from(other, Voxel::CHANNEL_TYPE);
+	});
+	_checksum += buffer.get_voxel(size / 2, size / 2, size / 2, Voxel::CHANNEL_TYPE);
+
+	// Worst case, the only different voxel is the last one
+	buffer.fill(1, Voxel::CHANNEL_TYPE);
+	buffer.set_voxel(0, size - 1, size - 1, size - 1, Voxel::CHANNEL_TYPE);
+	results["is_uniform"] = measure(_iterations, volume, [&](int i) {
+		_checksum += buffer.is_uniform(Voxel::CHANNEL_TYPE);
+	});
+
+	// What providers do after emerging a block, with mixed channels
+	results["compute_summary"] = measure(_iterations, volume, [&](int i) {
+		other.compute_summary();
+		_checksum += other.get_summary().non_air_count;
+	});
+
+	return results;
+}
+
+Dictionary VoxelBenchmark::run_simd_benchmarks() {
+
+	const int sizes[] = { 16, 32 };
+	// Operations are too fast to be timed one by one, so each run does many of them
+	const int repeat = 100;
+
+	const VoxelSimd::Level initial_level = VoxelSimd::get_level();
+	Dictionary results;
+
+	for (int si = 0; si < 2; ++si) {
+
+		const int size = sizes[si];
+		const uint32_t volume = size * size * size;
+
+		Ref<VoxelBuffer> buffer_ref;
+		buffer_ref.instance();
+		VoxelBuffer &buffer = **buffer_ref;
+		buffer.create(size, size, size);
+		generate_block(buffer, Vector3i(0, -size / 2, 0));
+
+		// Worst case for uniform checks, the only different voxel is the last one
+		Ref<VoxelBuffer> almost_uniform_ref;
+		almost_uniform_ref.instance();
+		VoxelBuffer &almost_uniform = **almost_uniform_ref;
+		almost_uniform.create(size, size, size);
+		almost_uniform.decompress_channel(Voxel::CHANNEL_TYPE);
+		almost_uniform.set_voxel(1, size - 1, size - 1, size - 1, Voxel::CHANNEL_TYPE);
+
+		Ref<VoxelBuffer> dst_ref;
+		dst_ref.instance();
+		VoxelBuffer &dst = **dst_ref;
+		dst.create(size, size, size);
+
+		Dictionary size_results;
+
+		for (int level = 0; level < VoxelSimd::LEVEL_COUNT; ++level) {
+
+			if (!VoxelSimd::set_level((VoxelSimd::Level)level))
+				continue;
+
+			Dictionary level_results;
+
+			level_results["is_uniform"] = measure(_iterations, volume * repeat, [&](int i) {
+				for (int r = 0; r < repeat; ++r)
+					_checksum += almost_uniform.is_uniform(Voxel::CHANNEL_TYPE);
+			});
+
+			level_results["min_max"] = measure(_iterations, volume * repeat, [&](int i) {
+				for (int r = 0; r < repeat; ++r) {
+					int min, max;
+					buffer.get_channel_min_max(Voxel::CHANNEL_ISOLEVEL, min, max);
+					_checksum += min + max;
+				}
+			});
+
+			level_results["histogram"] = measure(_iterations, volume * repeat, [&](int i) {
+				uint32_t counts[256] = { 0 };
+				for (int r = 0; r < repeat; ++r)
+					buffer.get_channel_histogram(Voxel::CHANNEL_ISOLEVEL, counts);
+				_checksum += counts[128];
+			});
+
+			size_results[VoxelSimd::get_level_name((VoxelSimd::Level)level)] = level_results;
+		}
+
+		VoxelSimd::set_level(initial_level);
+
+		// Copies don't depend on the instruction set.
+		// Half of the block along X, so all rows are whole but slices are not.
+		const Vector3i half(size / 2, size, size);
+		size_results["copy_area"] = measure(_iterations, volume / 2 * repeat, [&](int i) {
+			for (int r = 0; r < repeat; ++r)
+				dst.copy_from(buffer, Vector3i(0, 0, 0), half, Vector3i(r & 1, 0, 0), Voxel::CHANNEL_TYPE);
+			_checksum += dst.get_voxel(0, size / 2, 0, Voxel::CHANNEL_TYPE);
+		});
+
+		// Rows inside a bigger buffer, like copies done before meshing
+		const Vector3i inner(size - 2, size - 2, size - 2);
+		size_results["copy_rows"] = measure(_iterations, inner.x * inner.y * inner.z * repeat, [&](int i) {
+			for (int r = 0; r < repeat; ++r)
+				dst.copy_from(buffer, Vector3i(1, 1, 1), Vector3i(1, 1, 1) + inner, Vector3i(0, 0, 0), Voxel::CHANNEL_TYPE);
+			_checksum += dst.get_voxel(1, 1, 1, Voxel::CHANNEL_TYPE);
+		});
+
+		results[String::num(size)] = size_results;
+	}
+
+	results["default_level"] = VoxelSimd::get_level_name(initial_level);
+	return results;
+}
+
+Dictionary VoxelBenchmark::run_meshing_benchmarks() {
+
+	// Same padding as the terrain gives to meshers
+	const int block_size = 16;
+	const int padded_size = block_size + 3;
+	const int block_count = 8;
+
+	// Blocks crossing the surface at various places
+	Vector<Ref<VoxelBuffer> > blocks;
+	RandomPCG rng(_seed);
+	for (int i = 0; i < block_count; ++i) {
+		Ref<VoxelBuffer> buffer;
+		buffer.instance();
+		buffer->create(padded_size, padded_size, padded_size);
+		const Vector3i origin(rng.rand() % 1024, -block_size / 2 - 1, rng.rand() % 1024);
+		generate_block(**buffer, origin);
+		blocks.push_back(buffer);
+	}
+
+	Ref<VoxelLibrary> library;
+	library.instance();
+	library->load_default();
+
+	Ref<VoxelMesher> mesher;
+	mesher.instance();
+	mesher->set_library(library);
+
+	Ref<VoxelMesherSmooth> smooth_mesher;
+	smooth_mesher.instance();
+
+	Dictionary results;
+
+	results["mesh_blocky"] = measure(_iterations, 1, [&](int i) {
+		const VoxelBuffer &buffer = **blocks[i % block_count];
+		const Array surfaces = mesher->build(buffer, Voxel::CHANNEL_TYPE, Vector3i(0, 0, 0), buffer.get_size() - Vector3(1, 1, 1));
+		_checksum += get_surfaces_checksum(surfaces);
+	});
+
+	results["mesh_smooth"] = measure(_iterations, 1, [&](int i) {
+		const Array surfaces = smooth_mesher->build(**blocks[i % block_count], Voxel::CHANNEL_ISOLEVEL);
+		_checksum += get_surfaces_checksum(surfaces);
+	});
+
+	return results;
+}
+
+// Fills a map with blocks around the origin
+static void generate_map(VoxelMap &map, int radius_xz, int radius_y) {
+
+	const int block_size = map.get_block_size();
+	Vector3i bpos;
+
+	for (bpos.z = -radius_xz; bpos.z < radius_xz; ++bpos.z) {
+		for (bpos.x = -radius_xz; bpos.x < radius_xz; ++bpos.x) {
+			for (bpos.y = -radius_y; bpos.y < radius_y; ++bpos.y) {
+				Ref<VoxelBuffer> buffer;
+				buffer.instance();
+				buffer->create(block_size, block_size, block_size);
+				generate_block(**buffer, map.block_to_voxel(bpos));
+				buffer->optimize();
+				map.set_block_buffer(bpos, buffer);
+			}
+		}
+	}
+}
+
+Dictionary VoxelBenchmark::run_map_benchmarks() {
+
+	Ref<VoxelMap> map;
+	map.instance();
+	generate_map(**map, 4, 2);
+
+	const int block_size = map->get_block_size();
+	const int padded_size = block_size + 3;
+
+	Ref<VoxelBuffer> buffer;
+	buffer.instance();
+	buffer->create(padded_size, padded_size, padded_size);
+
+	RandomPCG rng(_seed);
+
+	Dictionary results;
+
+	// Same as what the terrain does before meshing a block, both channels
+	results["get_buffer_copy"] = measure(_iterations, padded_size * padded_size * padded_size, [&](int i) {
+		const Vector3i bpos(int(rng.rand() % 6) - 3, int(rng.rand() % 2) - 1, int(rng.rand() % 6) - 3);
+		map->get_buffer_copy(map->block_to_voxel(bpos) - Vector3i(1, 1, 1), **buffer, 0x3);
+		_checksum += buffer->get_voxel(padded_size / 2, padded_size / 2, padded_size / 2, Voxel::CHANNEL_TYPE);
+	});
+
+	return results;
+}
+
+Dictionary VoxelBenchmark::run_raycast_benchmarks(int ray_count) {
+
+	ERR_FAIL_COND_V(ray_count < 1, Dictionary());
+
+	// Only used for its map, so it doesn't need to be in the scene tree
+	VoxelTerrain *terrain = memnew(VoxelTerrain);
+	terrain->set_generate_meshes(false);
+	terrain->set_generate_collisions(false);
+
+	Ref<VoxelLibrary> library;
+	library.instance();
+	library->load_default();
+	terrain->set_voxel_library(library);
+
+	generate_map(**terrain->get_map(), 8, 2);
+
+	// Rays start above the hills and go down in random directions, so most of them hit
+	Vector<Vector3> origins;
+	Vector<Vector3> directions;
+	origins.resize(ray_count);
+	directions.resize(ray_count);
+
+	RandomPCG rng(_seed);
+	for (int i = 0; i < ray_count; ++i) {
+		origins.write[i] = Vector3(rng.random(-100.0f, 100.0f), 24, rng.random(-100.0f, 100.0f));
+		directions.write[i] = Vector3(rng.random(-1.0f, 1.0f), rng.random(-1.0f, -0.1f), rng.random(-1.0f, 1.0f)).normalized();
+	}
+
+	Vector<Vector3> positions;
+	Vector<Vector3> normals;
+	Vector<uint8_t> hits;
+	positions.resize(ray_count);
+	normals.resize(ray_count);
+	hits.resize(ray_count);
+
+	const real_t max_distance = 100;
+	// Rays are too fast to be timed one by one, so runs are whole sets of rays
+	const int iterations = MAX(1, _iterations / 10);
+
+	Dictionary results;
+
+	// One call per ray through the script API, which the batch is meant to replace
+	results["raycast"] = measure(iterations, ray_count, [&](int it) {
+		int hit_count = 0;
+		for (int i = 0; i < ray_count; ++i) {
+			const Variant hit = terrain->call("raycast", origins[i], directions[i], max_distance);
+			if (hit.get_type() != Variant::NIL)
+				++hit_count;
+		}
+		_checksum += hit_count;
+	});
+
+	results["raycast_batch"] = measure(iterations, ray_count, [&](int it) {
+		_checksum += terrain->raycast_batch(origins.ptr(), directions.ptr(), ray_count, max_distance,
+				positions.ptrw(), normals.ptrw(), hits.ptrw());
+	});
+
+	results["raycast_smooth_batch"] = measure(iterations, ray_count, [&](int it) {
+		_checksum += terrain->raycast_batch(origins.ptr(), directions.ptr(), ray_count, max_distance,
+				positions.ptrw(), normals.ptrw(), hits.ptrw(), true);
+	});
+
+	memdelete(terrain);
+
+	return results;
+}
+
+Dictionary VoxelBenchmark::run_all() {
+
+	VoxelPerformance *perf = VoxelPerformance::get_singleton();
+	ERR_FAIL_COND_V(perf == NULL, Dictionary());
+	perf->reset_peaks();
+
+	_checksum = 0;
+
+	Dictionary results;
+	results["buffer"] = run_buffer_benchmarks();
+	results["simd"] = run_simd_benchmarks();
+	results["meshing"] = run_meshing_benchmarks();
+	results["map"] = run_map_benchmarks();
+	results["raycast"] = run_raycast_benchmarks(10000);
+
+	Dictionary memory;
+	memory["channel_memory_peak"] = perf->get_monitor(VoxelPerformance::CHANNEL_MEMORY_PEAK);
+	memory["static_memory_peak"] = Memory::get_mem_max_usage();
+	results["memory"] = memory;
+
+	Dictionary config;
+	config["iterations"] = _iterations;
+	config["seed"] = _seed;
+	config["processor_count"] = OS::get_singleton()->get_processor_count();
+	results["config"] = config;
+
+	results["checksum"] = _checksum;
+
+	return results;
+}
+
+void VoxelBenchmark::_bind_methods() {
+
+	ClassDB::bind_method(D_METHOD("set_iterations", "iterations"), &VoxelBenchmark::set_iterations);
+	ClassDB::bind_method(D_METHOD("get_iterations"), &VoxelBenchmark::get_iterations);
+
+	ClassDB::bind_method(D_METHOD("set_seed", "seed"), &VoxelBenchmark::set_seed);
+	ClassDB::bind_method(D_METHOD("get_seed"), &VoxelBenchmark::get_seed);
+
+	ClassDB::bind_method(D_METHOD("run_buffer_benchmarks"), &VoxelBenchmark::run_buffer_benchmarks);
+	ClassDB::bind_method(D_METHOD("run_simd_benchmarks"), &VoxelBenchmark::run_simd_benchmarks);
+	ClassDB::bind_method(D_METHOD("run_meshing_benchmarks"), &VoxelBenchmark::run_meshing_benchmarks);
+	ClassDB::bind_method(D_METHOD("run_map_benchmarks"), &VoxelBenchmark::run_map_benchmarks);
+	ClassDB::bind_method(D_METHOD("run_raycast_benchmarks", "ray_count"), &VoxelBenchmark::run_raycast_benchmarks, DEFVAL(10000));
+	ClassDB::bind_method(D_METHOD("run_all"), &VoxelBenchmark::run_all);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "iterations"), "set_iterations", "get_iterations");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "seed"), "set_seed", "get_seed");
+}
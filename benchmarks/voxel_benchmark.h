@@ -0,0 +1,44 @@
+#ifndef VOXEL_BENCHMARK_H
+#define VOXEL_BENCHMARK_H
+
+#include <core/reference.h>
+
+// Measures voxel subsystems in isolation, without needing a scene or a renderer,
+// so it can run with the server platform. Data is generated from a fixed seed, so runs are comparable between builds.
+// Each benchmark returns a dictionary which can be saved as JSON, see benchmarks/run_benchmarks.gd.
+class VoxelBenchmark : public Reference {
+	GDCLASS(VoxelBenchmark, Reference)
+public:
+	VoxelBenchmark();
+
+	void set_iterations(int iterations);
+	int get_iterations() const { return _iterations; }
+
+	void set_seed(int seed);
+	int get_seed() const { return _seed; }
+
+	// Fill, copy and uniform check of a buffer
+	Dictionary run_buffer_benchmarks();
+	// Bulk operations on 16^3 and 32^3 blocks, with each instruction set the CPU supports
+	Dictionary run_simd_benchmarks();
+	// Blocky and smooth meshing of representative blocks, padded like the terrain does
+	Dictionary run_meshing_benchmarks();
+	// Copies of padded areas from a map, like the terrain does before meshing
+	Dictionary run_map_benchmarks();
+	// Random rays cast one by one, then in one batch
+	Dictionary run_raycast_benchmarks(int ray_count);
+
+	// Runs everything above, and adds peak memory usage
+	Dictionary run_all();
+
+private:
+	static void _bind_methods();
+
+	int _iterations;
+	int _seed;
+	// Results of the work are summed in there, so it can't be optimized away.
+	// It is also reported, and should not change between runs.
+	uint64_t _checksum;
+};
+
+#endif // VOXEL_BENCHMARK_H
@@ -8,4 +8,10 @@ def configure(env):
 	pass
 
 
+def get_opts(platform):
+	from SCons.Variables import BoolVariable
+	return [
+		BoolVariable('voxel_profiling', 'Record timings of voxel work with ZProfiler', False),
+		BoolVariable('voxel_benchmarks', 'Include VoxelBenchmark in builds without tools, such as export templates', False),
+	]
 
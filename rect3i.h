@@ -39,6 +39,10 @@ public:
 		return box;
 	}
 
+	bool inline is_empty() const {
+		return size.x <= 0 || size.y <= 0 || size.z <= 0;
+	}
+
 	bool inline contains(Vector3i p_pos) const {
 		Vector3i end = pos + size;
 		return p_pos.x >= pos.x
@@ -49,6 +53,70 @@ public:
 			&& p_pos.z < end.z;
 	}
 
+	bool inline intersects(const Rect3i &other) const {
+		Vector3i end = pos + size;
+		Vector3i other_end = other.pos + other.size;
+		return pos.x < other_end.x
+			&& pos.y < other_end.y
+			&& pos.z < other_end.z
+			&& other.pos.x < end.x
+			&& other.pos.y < end.y
+			&& other.pos.z < end.z;
+	}
+
+	// Difference between two boxes can be decomposed in at most 6 boxes
+	static const int MAX_DIFFERENCE_BOXES = 6;
+
+	// Splits the positions contained in `a` but not in `b` into boxes, without visiting any position.
+	// Returns how many boxes were written in `out_boxes`.
+	static int difference(Rect3i a, const Rect3i &b, Rect3i out_boxes[MAX_DIFFERENCE_BOXES]) {
+
+		int count = 0;
+		if (a.is_empty())
+			return count;
+
+		if (b.is_empty()) {
+			out_boxes[count++] = a;
+			return count;
+		}
+
+		const Vector3i b_end = b.pos + b.size;
+
+		// Cut slabs of `a` on each side of `b`, one axis after the other.
+		// What remains at the end is inside `b`.
+		for (unsigned int axis = 0; axis < 3; ++axis) {
+
+			const int a_end = a.pos[axis] + a.size[axis];
+
+			if (a.pos[axis] < b.pos[axis]) {
+				Rect3i slab = a;
+				int slab_end = MIN(b.pos[axis], a_end);
+				slab.size[axis] = slab_end - a.pos[axis];
+				out_boxes[count++] = slab;
+
+				a.pos[axis] = slab_end;
+				a.size[axis] = a_end - slab_end;
+			}
+
+			if (a_end > b_end[axis]) {
+				int slab_begin = MAX(b_end[axis], a.pos[axis]);
+				if (slab_begin < a_end) {
+					Rect3i slab = a;
+					slab.pos[axis] = slab_begin;
+					slab.size[axis] = a_end - slab_begin;
+					out_boxes[count++] = slab;
+
+					a.size[axis] = slab_begin - a.pos[axis];
+				}
+			}
+
+			if (a.is_empty())
+				break;
+		}
+
+		return count;
+	}
+
 	String to_string() const {
 		return String("(o:{0}, s:{1})").format(varray(pos.to_vec3(), size.to_vec3()));
 	}
@@ -75,4 +143,8 @@ inline bool operator!=(const Rect3i & a, const Rect3i & b) {
 	return a.pos != b.pos || a.size != b.size;
 }
 
+inline bool operator==(const Rect3i & a, const Rect3i & b) {
+	return a.pos == b.pos && a.size == b.size;
+}
+
 #endif // RECT3I_H
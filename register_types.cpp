@@ -8,9 +8,26 @@
 #include "voxel_provider_image.h"
 #include "voxel_box_mover.h"
 #include "transvoxel/voxel_mesher_smooth.h"
+#include "voxel_performance.h"
+#include "voxel_simd.h"
+#include "voxel_job_pool.h"
+#ifdef VOXEL_BENCHMARKS
+#include "benchmarks/voxel_benchmark.h"
+#endif
+#include "zprofiling.h"
+
+#include <core/engine.h>
 
 void register_voxel_types() {
 
+	VoxelSimd::init();
+
+#ifdef VOXEL_PROFILING
+	ZProfiler::create_singleton();
+#endif
+
+	VoxelJobPool::create_singleton();
+
 	ClassDB::register_class<Voxel>();
 	ClassDB::register_class<VoxelBuffer>();
 	ClassDB::register_class<VoxelMesher>();
@@ -22,10 +39,23 @@ void register_voxel_types() {
 	ClassDB::register_class<VoxelProviderImage>();
 	ClassDB::register_class<VoxelMesherSmooth>();
 	ClassDB::register_class<VoxelBoxMover>();
+	ClassDB::register_class<VoxelPerformance>();
+#ifdef VOXEL_BENCHMARKS
+	ClassDB::register_class<VoxelBenchmark>();
+#endif
+
+	VoxelPerformance::create_singleton();
+	Engine::get_singleton()->add_singleton(Engine::Singleton("VoxelPerformance", VoxelPerformance::get_singleton()));
 
 }
 
 void unregister_voxel_types() {
 
+	VoxelPerformance::destroy_singleton();
+	VoxelJobPool::destroy_singleton();
+
+#ifdef VOXEL_PROFILING
+	ZProfiler::destroy_singleton();
+#endif
 }
 
@@ -1,6 +1,7 @@
 
 #include "voxel_mesher_smooth.h"
 #include "transvoxel_tables.cpp"
+#include "../zprofiling.h"
 #include <core/os/os.h>
 
 inline float tof(int8_t v) {
@@ -135,6 +136,7 @@ Array VoxelMesherSmooth::build(const VoxelBuffer &voxels, unsigned int channel)
 }
 
 void VoxelMesherSmooth::build_internal(const VoxelBuffer &voxels, unsigned int channel) {
+	VOXEL_PROFILE_SCOPE("VoxelMesherSmooth::build_internal");
 
 	// Each 2x2 voxel group is a "cell"
 
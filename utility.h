@@ -41,6 +41,17 @@ void copy_to(PoolVector<T> &to, const Vector<T> &from) {
 	}
 }
 
+template <typename T>
+bool is_array_equal(const Vector<T> &a, const Vector<T> &b) {
+	if (a.size() != b.size())
+		return false;
+	for (int i = 0; i < a.size(); ++i) {
+		if (a[i] != b[i])
+			return false;
+	}
+	return true;
+}
+
 inline String ptr2s(const void *p) {
 	return String::num_uint64((uint64_t)p, 16);
 }
@@ -1,4 +1,7 @@
 #include "voxel_block.h"
+#include "voxel_performance.h"
+#include "voxel_visibility_builder.h"
+#include <servers/physics_server.h>
 
 // Helper
 VoxelBlock *VoxelBlock::create(Vector3i bpos, Ref<VoxelBuffer> buffer, unsigned int size) {
@@ -16,7 +19,9 @@ VoxelBlock *VoxelBlock::create(Vector3i bpos, Ref<VoxelBuffer> buffer, unsigned
 }
 
 VoxelBlock::VoxelBlock()
-	: voxels(NULL), _mesh_update_count(0) {
+	: voxels(NULL), loaded_neighbors(0), side_connections(VOXEL_ALL_SIDES_CONNECTED), culling_frame(0), _visible(true), _mesh_update_count(0), _mesh_vertex_count(0), _mesh_memory(0), _has_collision(false) {
+
+	VoxelPerformance::increment(VoxelPerformance::BLOCKS_LOADED, 1);
 
 	VisualServer &vs = *VisualServer::get_singleton();
 
@@ -26,6 +31,60 @@ VoxelBlock::VoxelBlock()
 	}
 }
 
+VoxelBlock::~VoxelBlock() {
+
+	if (_mesh_instance.is_valid()) {
+		VisualServer::get_singleton()->free(_mesh_instance);
+		_mesh_instance = RID();
+	}
+
+	clear_collision();
+
+	VoxelPerformance::decrement(VoxelPerformance::MESH_VERTICES, _mesh_vertex_count);
+	VoxelPerformance::decrement(VoxelPerformance::MESH_MEMORY, _mesh_memory);
+	VoxelPerformance::decrement(VoxelPerformance::BLOCKS_LOADED, 1);
+}
+
+static int get_mesh_vertex_count(const Ref<Mesh> &mesh) {
+	int count = 0;
+	if (mesh.is_valid()) {
+		for (int i = 0; i < mesh->get_surface_count(); ++i)
+			count += mesh->surface_get_array_len(i);
+	}
+	return count;
+}
+
+static size_t get_mesh_memory_usage(const Ref<Mesh> &mesh) {
+
+	if (mesh.is_null())
+		return 0;
+
+	size_t size = 0;
+	for (int i = 0; i < mesh->get_surface_count(); ++i) {
+
+		const uint32_t format = mesh->surface_get_format(i);
+		size_t vertex_size = 0;
+		if (format & Mesh::ARRAY_FORMAT_VERTEX)
+			vertex_size += sizeof(Vector3);
+		if (format & Mesh::ARRAY_FORMAT_NORMAL)
+			vertex_size += sizeof(Vector3);
+		if (format & Mesh::ARRAY_FORMAT_TANGENT)
+			vertex_size += sizeof(float) * 4;
+		if (format & Mesh::ARRAY_FORMAT_COLOR)
+			vertex_size += sizeof(Color);
+		if (format & Mesh::ARRAY_FORMAT_TEX_UV)
+			vertex_size += sizeof(Vector2);
+		if (format & Mesh::ARRAY_FORMAT_TEX_UV2)
+			vertex_size += sizeof(Vector2);
+
+		size += mesh->surface_get_array_len(i) * vertex_size;
+		if (format & Mesh::ARRAY_FORMAT_INDEX)
+			size += mesh->surface_get_array_index_len(i) * sizeof(int);
+	}
+
+	return size;
+}
+
 void VoxelBlock::set_mesh(Ref<Mesh> mesh, Ref<World> world) {
 
 	VisualServer &vs = *VisualServer::get_singleton();
@@ -37,6 +96,7 @@ void VoxelBlock::set_mesh(Ref<Mesh> mesh, Ref<World> world) {
 			ERR_FAIL_COND(world.is_null());
 			_mesh_instance = vs.instance_create();
 			vs.instance_set_scenario(_mesh_instance, world->get_scenario());
+			vs.instance_set_visible(_mesh_instance, _visible);
 		}
 
 		vs.instance_set_base(_mesh_instance, mesh.is_valid() ? mesh->get_rid() : RID());
@@ -54,6 +114,14 @@ void VoxelBlock::set_mesh(Ref<Mesh> mesh, Ref<World> world) {
 		}
 	}
 
+	VoxelPerformance::decrement(VoxelPerformance::MESH_VERTICES, _mesh_vertex_count);
+	_mesh_vertex_count = get_mesh_vertex_count(mesh);
+	VoxelPerformance::increment(VoxelPerformance::MESH_VERTICES, _mesh_vertex_count);
+
+	VoxelPerformance::decrement(VoxelPerformance::MESH_MEMORY, _mesh_memory);
+	_mesh_memory = get_mesh_memory_usage(mesh);
+	VoxelPerformance::increment(VoxelPerformance::MESH_MEMORY, _mesh_memory);
+
 	_mesh = mesh;
 	++_mesh_update_count;
 
@@ -62,11 +130,68 @@ void VoxelBlock::set_mesh(Ref<Mesh> mesh, Ref<World> world) {
 //	}
 }
 
+void VoxelBlock::set_collision(const Vector<AABB> &boxes, PoolVector<Vector3> faces, Ref<World> world, ObjectID owner_id) {
+
+	clear_collision();
+	_has_collision = true;
+
+	if(boxes.empty() && faces.size() == 0) {
+		// Nothing to collide with
+		return;
+	}
+
+	ERR_FAIL_COND(world.is_null());
+
+	PhysicsServer &ps = *PhysicsServer::get_singleton();
+
+	_collision_body = ps.body_create(PhysicsServer::BODY_MODE_STATIC);
+	ps.body_attach_object_instance_id(_collision_body, owner_id);
+	ps.body_set_state(_collision_body, PhysicsServer::BODY_STATE_TRANSFORM, Transform(Basis(), _position_in_voxels.to_vec3()));
+
+	for(int i = 0; i < boxes.size(); ++i) {
+		const AABB &box = boxes[i];
+		RID shape = ps.shape_create(PhysicsServer::SHAPE_BOX);
+		ps.shape_set_data(shape, box.size * 0.5);
+		ps.body_add_shape(_collision_body, shape, Transform(Basis(), box.position + box.size * 0.5));
+		_collision_shapes.push_back(shape);
+	}
+
+	if(faces.size() != 0) {
+		RID shape = ps.shape_create(PhysicsServer::SHAPE_CONCAVE_POLYGON);
+		ps.shape_set_data(shape, faces);
+		ps.body_add_shape(_collision_body, shape);
+		_collision_shapes.push_back(shape);
+	}
+
+	// Setting the space last so the body doesn't get simulated while shapes are added
+	ps.body_set_space(_collision_body, world->get_space());
+}
+
+void VoxelBlock::clear_collision() {
+
+	PhysicsServer &ps = *PhysicsServer::get_singleton();
+
+	if(_collision_body.is_valid()) {
+		ps.free(_collision_body);
+		_collision_body = RID();
+	}
+
+	for(int i = 0; i < _collision_shapes.size(); ++i) {
+		ps.free(_collision_shapes[i]);
+	}
+	_collision_shapes.clear();
+
+	_has_collision = false;
+}
+
 void VoxelBlock::enter_world(World *world) {
 	if(_mesh_instance.is_valid()) {
 		VisualServer &vs = *VisualServer::get_singleton();
 		vs.instance_set_scenario(_mesh_instance, world->get_scenario());
 	}
+	if(_collision_body.is_valid()) {
+		PhysicsServer::get_singleton()->body_set_space(_collision_body, world->get_space());
+	}
 }
 
 void VoxelBlock::exit_world() {
@@ -74,9 +199,13 @@ void VoxelBlock::exit_world() {
 		VisualServer &vs = *VisualServer::get_singleton();
 		vs.instance_set_scenario(_mesh_instance, RID());
 	}
+	if(_collision_body.is_valid()) {
+		PhysicsServer::get_singleton()->body_set_space(_collision_body, RID());
+	}
 }
 
 void VoxelBlock::set_visible(bool visible) {
+	_visible = visible;
 	if(_mesh_instance.is_valid()) {
 		VisualServer &vs = *VisualServer::get_singleton();
 		vs.instance_set_visible(_mesh_instance, visible);
@@ -12,14 +12,31 @@ class VoxelBlock {
 public:
 	Ref<VoxelBuffer> voxels; // SIZE*SIZE*SIZE voxels
 	Vector3i pos;
+	// How many of the 26 neighbor blocks are present in the map. Maintained by VoxelMap.
+	unsigned int loaded_neighbors;
+	// Which sides of the block can see each other, found when it was last meshed. See build_voxel_side_connections().
+	uint64_t side_connections;
+	// Last frame in which the terrain found the block could be seen from a viewer, when culling blocks
+	uint32_t culling_frame;
 
 	static VoxelBlock *create(Vector3i bpos, Ref<VoxelBuffer> buffer, unsigned int size);
 
+	~VoxelBlock();
+
 	void set_mesh(Ref<Mesh> mesh, Ref<World> world);
+	// Estimated bytes used by the mesh, without compression
+	size_t get_mesh_memory_usage() const { return _mesh_memory; }
+
+	// Replaces collision shapes of the block. Boxes and faces are local to the block.
+	// Can be called with no shapes, in which case the block is considered to have empty collision.
+	void set_collision(const Vector<AABB> &boxes, PoolVector<Vector3> faces, Ref<World> world, ObjectID owner_id);
+	void clear_collision();
+	bool has_collision() const { return _has_collision; }
 
 	void enter_world(World *world);
 	void exit_world();
 	void set_visible(bool visible);
+	bool is_visible() const { return _visible; }
 
 private:
 	VoxelBlock();
@@ -28,7 +45,15 @@ private:
 
 	Ref<Mesh> _mesh;
 	RID _mesh_instance;
+	bool _visible;
 	int _mesh_update_count;
+	// Counted in performance monitors
+	int _mesh_vertex_count;
+	size_t _mesh_memory;
+
+	RID _collision_body;
+	Vector<RID> _collision_shapes;
+	bool _has_collision;
 };
 
 #endif // VOXEL_BLOCK_H
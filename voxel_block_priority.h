@@ -0,0 +1,97 @@
+#ifndef VOXEL_BLOCK_PRIORITY_H
+#define VOXEL_BLOCK_PRIORITY_H
+
+#include "utility.h"
+#include "vector3i.h"
+#include <core/math/math_funcs.h>
+
+// Tells which blocks should be processed first.
+// Blocks closest to any of the points go first. Points are usually where viewers are expected to be soon,
+// and can have a direction so blocks in front of them appear closer than blocks behind.
+struct VoxelBlockPriority {
+	Vector<Vector3i> positions;
+	// Normalized, or zero if the point has no preferred direction
+	Vector<Vector3> directions;
+	// How much closer blocks in front of a point appear, in [0, 1[
+	float direction_weight;
+
+	VoxelBlockPriority() : direction_weight(0) {}
+
+	void add_point(Vector3i pos, Vector3 direction) {
+		positions.push_back(pos);
+		directions.push_back(direction);
+	}
+
+	// Lower is more urgent. Returns 0 if there are no points.
+	float get_cost(const Vector3i &bpos) const {
+		float min_cost = 0;
+		for (int i = 0; i < positions.size(); ++i) {
+			Vector3 d = (bpos - positions[i]).to_vec3();
+			float cost = d.length_squared();
+			if (direction_weight > 0 && cost > 0) {
+				// Same as distance_sq * (1 - weight * cos(angle))
+				cost -= direction_weight * Math::sqrt(cost) * d.dot(directions[i]);
+			}
+			if (i == 0 || cost < min_cost)
+				min_cost = cost;
+		}
+		return min_cost;
+	}
+
+	// Sorts items from most to least urgent. `get_position(item)` returns the block position of an item,
+	// and `is_urgent(item)` tells if it goes before others whatever its cost.
+	// Each cost loops over all points, so it is computed once per item rather than in every comparison.
+	template <typename T, typename GetPosition_F, typename IsUrgent_F>
+	void sort(Vector<T> &items, GetPosition_F get_position, IsUrgent_F is_urgent) const {
+
+		const int count = items.size();
+		if (count < 2)
+			return;
+
+		Vector<SortKey> keys;
+		keys.resize(count);
+		SortKey *keys_data = keys.ptrw();
+		const T *items_data = items.ptr();
+		for (int i = 0; i < count; ++i) {
+			SortKey &key = keys_data[i];
+			key.index = i;
+			key.urgent = is_urgent(items_data[i]);
+			key.cost = get_cost(get_position(items_data[i]));
+		}
+
+		keys.sort();
+
+		Vector<T> sorted;
+		sorted.resize(count);
+		T *sorted_data = sorted.ptrw();
+		for (int i = 0; i < count; ++i) {
+			sorted_data[i] = items_data[keys[i].index];
+		}
+		items = sorted;
+	}
+
+private:
+	struct SortKey {
+		int index;
+		bool urgent;
+		float cost;
+
+		inline bool operator<(const SortKey &other) const {
+			if (urgent != other.urgent)
+				return urgent;
+			return cost < other.cost;
+		}
+	};
+};
+
+inline bool operator==(const VoxelBlockPriority &a, const VoxelBlockPriority &b) {
+	return a.direction_weight == b.direction_weight
+		&& is_array_equal(a.positions, b.positions)
+		&& is_array_equal(a.directions, b.directions);
+}
+
+inline bool operator!=(const VoxelBlockPriority &a, const VoxelBlockPriority &b) {
+	return !(a == b);
+}
+
+#endif // VOXEL_BLOCK_PRIORITY_H
@@ -1,153 +1,205 @@
 #include "voxel_box_mover.h"
 #include "voxel_map.h"
+#include "voxel_job_pool.h"
+
+// Tells which voxels are solid, reading blocks directly.
+// Remembers the last block accessed, since sweeps visit voxels of the same block in a row.
+class SolidVoxelQuery {
+public:
+	SolidVoxelQuery(const VoxelMap &map) :
+			_map(map),
+			_block_size_pow2(map.get_block_size_pow2()),
+			_block_size_mask(map.get_block_size_mask()),
+			_default_type(map.get_default_voxel(Voxel::CHANNEL_TYPE)),
+			_has_cache(false),
+			_voxels(NULL),
+			_types(NULL),
+			_uniform_type(0) {}
+
+	_FORCE_INLINE_ bool is_solid(const Vector3i &pos) {
+
+		const Vector3i bpos = VoxelMap::voxel_to_block_b(pos, _block_size_pow2);
+		if (!_has_cache || bpos != _cached_bpos) {
+			load_block(bpos);
+		}
 
-static AABB expand_with_vector(AABB box, Vector3 v) {
+		if (_types == NULL)
+			return _uniform_type != 0;
 
-	if(v.x > 0) {
-		box.size.x += v.x;
-	} else if(v.x < 0) {
-		box.position.x += v.x;
-		box.size.x -= v.x;
+		const unsigned int i = _voxels->index(pos.x & _block_size_mask, pos.y & _block_size_mask, pos.z & _block_size_mask);
+		return _types[i] != 0;
 	}
 
-	if(v.y > 0) {
-		box.size.y += v.y;
-	} else if(v.y < 0) {
-		box.position.y += v.y;
-		box.size.y -= v.y;
-	}
+private:
+	void load_block(Vector3i bpos) {
+
+		_has_cache = true;
+		_cached_bpos = bpos;
+
+		const VoxelBlock *block = _map.get_block(bpos);
+		if (block == NULL || block->voxels.is_null()) {
+			_voxels = NULL;
+			_types = NULL;
+			_uniform_type = _default_type;
+			return;
+		}
 
-	if(v.z > 0) {
-		box.size.z += v.z;
-	} else if(v.z < 0) {
-		box.position.z += v.z;
-		box.size.z -= v.z;
+		_voxels = *block->voxels;
+		_types = _voxels->get_channel_raw(Voxel::CHANNEL_TYPE);
+		_uniform_type = _types == NULL ? _voxels->get_voxel(0, 0, 0, Voxel::CHANNEL_TYPE) : 0;
 	}
 
-	return box;
+	const VoxelMap &_map;
+	const unsigned int _block_size_pow2;
+	const unsigned int _block_size_mask;
+	const int _default_type;
+
+	bool _has_cache;
+	Vector3i _cached_bpos;
+	const VoxelBuffer *_voxels;
+	const uint8_t *_types;
+	int _uniform_type;
+};
+
+// Tests if any voxel of the layer `layer` along axis `i` is solid, within a rectangle of the two other axes
+static bool is_layer_solid(SolidVoxelQuery &query, int i, int layer, int j, int min_j, int max_j, int k, int min_k, int max_k) {
+	Vector3i pos;
+	pos[i] = layer;
+	for (pos[k] = min_k; pos[k] < max_k; ++pos[k]) {
+		for (pos[j] = min_j; pos[j] < max_j; ++pos[j]) {
+			if (query.is_solid(pos))
+				return true;
+		}
+	}
+	return false;
 }
 
-static float calculate_i_offset(AABB box, AABB other, float motion, int i, int j, int k) {
+// Moves a box along one axis until it touches a solid voxel, and returns how far it could go.
+// Voxel layers are visited in order from the box to where the motion ends,
+// so it stops at the first one in the way without looking at voxels beyond it.
+static float sweep_axis(SolidVoxelQuery &query, const AABB &box, float motion, int i, int j, int k) {
 
 	const float EPSILON = 0.001;
 
-	Vector3 other_end = other.position + other.size;
-	Vector3 box_end = box.position + box.size;
-
-	if(other_end[k] <= box.position[k] || other.position[k] >= box_end[k])
-		return motion;
-
-	if(other_end[j] <= box.position[j] || other.position[j] >= box_end[j])
+	if (motion == 0.f)
 		return motion;
 
-	if(motion > 0.0 && other_end[i] <= box.position[i]) {
-		float off = box.position[i] - other_end[i] - EPSILON;
-		if(off < motion)
-			motion = off;
-	}
+	const Vector3 box_end = box.position + box.size;
+
+	// Voxels overlapping the box on the other axes. Touching is not overlapping.
+	const int min_j = int(Math::floor(box.position[j]));
+	const int max_j = int(Math::ceil(box_end[j]));
+	const int min_k = int(Math::floor(box.position[k]));
+	const int max_k = int(Math::ceil(box_end[k]));
+
+	if (motion > 0.f) {
+		const int begin = int(Math::ceil(box_end[i]));
+		const int end = int(Math::ceil(box_end[i] + motion));
+		for (int layer = begin; layer < end; ++layer) {
+			if (is_layer_solid(query, i, layer, j, min_j, max_j, k, min_k, max_k)) {
+				const float off = layer - box_end[i] - EPSILON;
+				return off < motion ? off : motion;
+			}
+		}
 
-	if(motion < 0.0 && other.position[i] >= box_end[i]) {
-		float off = box_end[i] - other.position[i] + EPSILON;
-		if(off > motion)
-			motion = off;
+	} else {
+		const int begin = int(Math::floor(box.position[i])) - 1;
+		const int end = int(Math::floor(box.position[i] + motion)) - 1;
+		for (int layer = begin; layer > end; --layer) {
+			if (is_layer_solid(query, i, layer, j, min_j, max_j, k, min_k, max_k)) {
+				const float off = layer + 1 - box.position[i] + EPSILON;
+				return off > motion ? off : motion;
+			}
+		}
 	}
 
 	return motion;
 }
 
 // Gets the transformed vector for moving a box and slide.
-// This algorithm is free from tunnelling for axis-aligned movement,
-// except in some high-speed diagonal cases or huge size differences:
-// For example, if a box is fast enough to have a diagonal motion jumping from A to B,
-// it will pass through C if that other box is the only other one:
-//
-//  o---o
-//  | A |
-//  o---o
-//          o---o
-//          | C |
-//          o---o
-//                  o---o
-//                  | B |
-//                  o---o
-//
-// TODO one way to fix this would be to try a "hot side" projection instead
-//
-static Vector3 get_motion(AABB box, Vector3 motion, const Vector<AABB> &other_boxes) {
-	// The bounding box is expanded to include it's estimated version at next update.
-	// This also makes the algorithm tunnelling-free
-	AABB expanded_box = expand_with_vector(box, motion);
-
-	Vector<AABB> colliding_boxes;
-	for(int i = 0; i < other_boxes.size(); ++i) {
-		AABB other = other_boxes[i];
-		if(expanded_box.intersects(other_boxes[i]))
-			colliding_boxes.push_back(other);
-	}
-
-	if (colliding_boxes.size() == 0)
-		return motion;
-
-	//print("Colliding: ", colliding_boxes.size())
+// Axes are resolved one after the other, so a fast diagonal motion can't jump over a corner.
+static Vector3 get_motion(SolidVoxelQuery &query, AABB box, Vector3 motion) {
 
 	Vector3 new_motion = motion;
 
-	for(int i = 0; i < colliding_boxes.size(); ++i)
-		new_motion.y = calculate_i_offset(colliding_boxes[i], box, new_motion.y, 1, 0, 2);
+	new_motion.y = sweep_axis(query, box, new_motion.y, Vector3::AXIS_Y, Vector3::AXIS_X, Vector3::AXIS_Z);
 	box.position.y += new_motion.y;
 
-	for(int i = 0; i < colliding_boxes.size(); ++i)
-		new_motion.x = calculate_i_offset(colliding_boxes[i], box, new_motion.x, 0, 1, 2);
+	new_motion.x = sweep_axis(query, box, new_motion.x, Vector3::AXIS_X, Vector3::AXIS_Y, Vector3::AXIS_Z);
 	box.position.x += new_motion.x;
 
-	for(int i = 0; i < colliding_boxes.size(); ++i)
-		new_motion.z = calculate_i_offset(colliding_boxes[i], box, new_motion.z, 2, 1, 0);
-	box.position.z += new_motion.z;
+	new_motion.z = sweep_axis(query, box, new_motion.z, Vector3::AXIS_Z, Vector3::AXIS_Y, Vector3::AXIS_X);
 
 	return new_motion;
 }
 
+// Entities given to one worker thread
+struct _VoxelBoxMoverJob {
+	const VoxelMap *map;
+	const Vector3 *positions;
+	Vector3 *motions;
+	AABB aabb;
+	int begin;
+	int end;
+
+	void run() {
+		SolidVoxelQuery query(*map);
+		for (int i = begin; i < end; ++i) {
+			motions[i] = get_motion(query, AABB(aabb.position + positions[i], aabb.size), motions[i]);
+		}
+	}
+
+	static void run_job(void *p_jobs, int job_index) {
+		reinterpret_cast<_VoxelBoxMoverJob *>(p_jobs)[job_index].run();
+	}
+};
+
 Vector3 VoxelBoxMover::get_motion(Vector3 pos, Vector3 motion, AABB aabb, VoxelTerrain *terrain) {
 
 	ERR_FAIL_COND_V(terrain == NULL, Vector3());
 
-	AABB box(aabb.position + pos, aabb.size);
-	AABB expanded_box = expand_with_vector(box, motion);
+	Ref<VoxelMap> voxels_ref = terrain->get_map();
+	ERR_FAIL_COND_V(voxels_ref.is_null(), Vector3());
+
+	SolidVoxelQuery query(**voxels_ref);
+	return ::get_motion(query, AABB(aabb.position + pos, aabb.size), motion);
+}
 
-	Vector<AABB> potential_boxes;
+void VoxelBoxMover::get_motions(const Vector3 *positions, Vector3 *motions, int count, AABB aabb, VoxelTerrain *terrain) {
 
-	// Collect collisions with the terrain
+	ERR_FAIL_COND(terrain == NULL);
+	ERR_FAIL_COND(count < 0);
 
 	Ref<VoxelMap> voxels_ref = terrain->get_map();
-	ERR_FAIL_COND_V(voxels_ref.is_null(), Vector3());
-	VoxelMap &voxels = **voxels_ref;
+	ERR_FAIL_COND(voxels_ref.is_null());
 
-	int min_x = int(Math::floor(expanded_box.position.x));
-	int min_y = int(Math::floor(expanded_box.position.y));
-	int min_z = int(Math::floor(expanded_box.position.z));
+	VoxelJobPool *pool = VoxelJobPool::get_singleton();
+	ERR_FAIL_COND(pool == NULL);
 
-	Vector3 expanded_box_end = expanded_box.position + expanded_box.size;
-	int max_x = int(Math::ceil(expanded_box_end.x));
-	int max_y = int(Math::ceil(expanded_box_end.y));
-	int max_z = int(Math::ceil(expanded_box_end.z));
+	// Below that, handing entities to another thread costs more than it saves
+	const int min_entities_per_job = 64;
+	const int max_jobs = VoxelJobPool::MAX_WORKERS + 1;
 
-	Vector3i i(min_x, min_y, min_z);
+	int job_count = MIN(pool->get_concurrency(), count / min_entities_per_job);
+	if (job_count < 1)
+		job_count = 1;
 
-	for (i.z = min_z; i.z < max_z; ++i.z) {
-		for (i.y = min_y; i.y < max_y; ++i.y) {
-			for (i.x = min_x; i.x < max_x; ++i.x) {
+	_VoxelBoxMoverJob jobs[max_jobs];
 
-				int voxel_type = voxels.get_voxel(i, 0);
-				if(voxel_type != 0) {
-					AABB voxel_box = AABB(i.to_vec3(), Vector3(1,1,1));
-					potential_boxes.push_back(voxel_box);
-				}
-			}
-		}
+	const int entities_per_job = count / job_count;
+
+	for (int i = 0; i < job_count; ++i) {
+		_VoxelBoxMoverJob &job = jobs[i];
+		job.map = *voxels_ref;
+		job.positions = positions;
+		job.motions = motions;
+		job.aabb = aabb;
+		job.begin = i * entities_per_job;
+		job.end = i + 1 == job_count ? count : job.begin + entities_per_job;
 	}
 
-	// Calculate collisions
-	return ::get_motion(box, motion, potential_boxes);
+	// Workers only read the map
+	pool->run(_VoxelBoxMoverJob::run_job, jobs, job_count);
 }
 
 Vector3 VoxelBoxMover::_get_motion_binding(Vector3 pos, Vector3 motion, AABB aabb, Node *terrain_node) {
@@ -157,8 +209,23 @@ Vector3 VoxelBoxMover::_get_motion_binding(Vector3 pos, Vector3 motion, AABB aab
 	return get_motion(pos, motion, aabb, terrain);
 }
 
+PoolVector3Array VoxelBoxMover::_get_motions_binding(PoolVector3Array positions, PoolVector3Array motions, AABB aabb, Node *terrain_node) {
+	ERR_FAIL_COND_V(terrain_node == NULL, PoolVector3Array());
+	VoxelTerrain *terrain = Object::cast_to<VoxelTerrain>(terrain_node);
+	ERR_FAIL_COND_V(terrain == NULL, PoolVector3Array());
+	ERR_FAIL_COND_V(positions.size() != motions.size(), PoolVector3Array());
+
+	PoolVector3Array new_motions = motions;
+	{
+		PoolVector3Array::Read positions_read = positions.read();
+		PoolVector3Array::Write motions_write = new_motions.write();
+		get_motions(positions_read.ptr(), motions_write.ptr(), positions.size(), aabb, terrain);
+	}
+	return new_motions;
+}
+
 void VoxelBoxMover::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD("get_motion", "pos", "motion", "aabb", "terrain"), &VoxelBoxMover::_get_motion_binding);
+	ClassDB::bind_method(D_METHOD("get_motions", "positions", "motions", "aabb", "terrain"), &VoxelBoxMover::_get_motions_binding);
 }
-
@@ -10,8 +10,13 @@ class VoxelBoxMover : public Reference {
 public:
 	Vector3 get_motion(Vector3 pos, Vector3 motion, AABB aabb, VoxelTerrain *terrain);
 
+	// Same as get_motion for many entities sharing the same box, spread over the threads of VoxelJobPool.
+	// `motions` are replaced by the resulting motions. The map must not be modified until it returns.
+	void get_motions(const Vector3 *positions, Vector3 *motions, int count, AABB aabb, VoxelTerrain *terrain);
+
 protected:
 	Vector3 _get_motion_binding(Vector3 pos, Vector3 motion, AABB aabb, Node *terrain_node);
+	PoolVector3Array _get_motions_binding(PoolVector3Array positions, PoolVector3Array motions, AABB aabb, Node *terrain_node);
 
 	static void _bind_methods();
 };
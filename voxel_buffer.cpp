@@ -1,9 +1,15 @@
 #include "voxel_buffer.h"
+#include "cube_tables.h"
+#include "voxel.h"
+#include "voxel_performance.h"
+#include "voxel_simd.h"
 
 #include <core/math/math_funcs.h>
 #include <string.h>
 
 VoxelBuffer::VoxelBuffer() {
+	// Empty, and all channels uniform
+	compute_summary();
 }
 
 VoxelBuffer::~VoxelBuffer() {
@@ -25,6 +31,7 @@ void VoxelBuffer::create(int sx, int sy, int sz) {
 			}
 		}
 		_size = new_size;
+		compute_summary();
 	}
 }
 
@@ -35,6 +42,7 @@ void VoxelBuffer::clear() {
 			delete_channel(i);
 		}
 	}
+	compute_summary();
 }
 
 void VoxelBuffer::clear_channel(unsigned int channel_index, int clear_value) {
@@ -42,12 +50,15 @@ void VoxelBuffer::clear_channel(unsigned int channel_index, int clear_value) {
 	if (_channels[channel_index].data)
 		delete_channel(channel_index);
 	_channels[channel_index].defval = clear_value;
+	update_summary_uniform(channel_index, clear_value);
 }
 
 void VoxelBuffer::set_default_values(uint8_t values[VoxelBuffer::MAX_CHANNELS]) {
 	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
 		_channels[i].defval = values[i];
 	}
+	// Uniform channels changed value
+	compute_summary();
 }
 
 int VoxelBuffer::get_voxel(int x, int y, int z, unsigned int channel_index) const {
@@ -67,14 +78,18 @@ void VoxelBuffer::set_voxel(int value, int x, int y, int z, unsigned int channel
 	ERR_FAIL_COND(!validate_pos(x, y, z));
 
 	Channel &channel = _channels[channel_index];
+	const unsigned int i = index(x, y, z);
 
 	if (channel.data == NULL) {
 		if (channel.defval != value) {
-			create_channel(channel_index, _size);
-			channel.data[index(x, y, z)] = value;
+			create_channel(channel_index, _size, channel.defval);
+			channel.data[i] = value;
+			update_summary(channel_index, x, y, z, channel.defval, value);
 		}
 	} else {
-		channel.data[index(x, y, z)] = value;
+		const uint8_t old_value = channel.data[i];
+		channel.data[i] = value;
+		update_summary(channel_index, x, y, z, old_value, value);
 	}
 }
 
@@ -85,14 +100,18 @@ void VoxelBuffer::try_set_voxel(int x, int y, int z, int value, unsigned int cha
 		return;
 
 	Channel &channel = _channels[channel_index];
+	const unsigned int i = index(x, y, z);
 
 	if (channel.data == NULL) {
 		if (channel.defval != value) {
-			create_channel(channel_index, _size);
-			channel.data[index(x, y, z)] = value;
+			create_channel(channel_index, _size, channel.defval);
+			channel.data[i] = value;
+			update_summary(channel_index, x, y, z, channel.defval, value);
 		}
 	} else {
-		channel.data[index(x, y, z)] = value;
+		const uint8_t old_value = channel.data[i];
+		channel.data[i] = value;
+		update_summary(channel_index, x, y, z, old_value, value);
 	}
 }
 
@@ -100,26 +119,79 @@ void VoxelBuffer::set_voxel_v(int value, Vector3 pos, unsigned int channel_index
 	set_voxel(value, pos.x, pos.y, pos.z, channel_index);
 }
 
+// Rows go along Y. When an area covers whole rows, consecutive rows are contiguous in memory,
+// and when it also covers whole slices, the area is contiguous.
+// Copying them at once instead of row by row avoids many small memcpy calls on short rows.
+static void copy_area_raw(const uint8_t *src, Vector3i src_size, Vector3i src_min,
+		uint8_t *dst, Vector3i dst_size, Vector3i dst_min, Vector3i area_size) {
+
+	const bool full_rows = area_size.y == src_size.y && area_size.y == dst_size.y;
+	const bool full_slices = full_rows && area_size.x == src_size.x && area_size.x == dst_size.x;
+
+	const unsigned int src_slice = src_size.x * src_size.y;
+	const unsigned int dst_slice = dst_size.x * dst_size.y;
+	const unsigned int src_begin = (src_min.z * src_size.x + src_min.x) * src_size.y + src_min.y;
+	const unsigned int dst_begin = (dst_min.z * dst_size.x + dst_min.x) * dst_size.y + dst_min.y;
+
+	if (full_slices) {
+		memcpy(dst + dst_begin, src + src_begin, area_size.x * area_size.y * area_size.z);
+		return;
+	}
+
+	for (int z = 0; z < area_size.z; ++z) {
+		const uint8_t *src_slice_ptr = src + src_begin + z * src_slice;
+		uint8_t *dst_slice_ptr = dst + dst_begin + z * dst_slice;
+
+		if (full_rows) {
+			memcpy(dst_slice_ptr, src_slice_ptr, area_size.x * area_size.y);
+		} else {
+			for (int x = 0; x < area_size.x; ++x) {
+				memcpy(dst_slice_ptr + x * dst_size.y, src_slice_ptr + x * src_size.y, area_size.y);
+			}
+		}
+	}
+}
+
+static void fill_area_raw(uint8_t *dst, Vector3i dst_size, Vector3i dst_min, Vector3i area_size, uint8_t value) {
+
+	const bool full_rows = area_size.y == dst_size.y;
+	const bool full_slices = full_rows && area_size.x == dst_size.x;
+
+	const unsigned int dst_slice = dst_size.x * dst_size.y;
+	const unsigned int dst_begin = (dst_min.z * dst_size.x + dst_min.x) * dst_size.y + dst_min.y;
+
+	if (full_slices) {
+		memset(dst + dst_begin, value, area_size.x * area_size.y * area_size.z);
+		return;
+	}
+
+	for (int z = 0; z < area_size.z; ++z) {
+		uint8_t *dst_slice_ptr = dst + dst_begin + z * dst_slice;
+
+		if (full_rows) {
+			memset(dst_slice_ptr, value, area_size.x * area_size.y);
+		} else {
+			for (int x = 0; x < area_size.x; ++x) {
+				memset(dst_slice_ptr + x * dst_size.y, value, area_size.y);
+			}
+		}
+	}
+}
+
 void VoxelBuffer::fill(int defval, unsigned int channel_index) {
 	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
 
 	Channel &channel = _channels[channel_index];
 	if (channel.data == NULL) {
-		// Channel is already optimized and uniform
-		if(channel.defval == defval) {
-			// No change
-			return;
-		} else {
-			// Just change default value
-			channel.defval = defval;
-			return;
-		}
+		// Channel is already optimized and uniform.
+		// If the value differs, just change default value
+		channel.defval = defval;
+	} else {
+		unsigned int volume = get_volume();
+		memset(channel.data, defval, volume);
 	}
-	else
-		create_channel_noinit(channel_index, _size);
 
-	unsigned int volume = get_volume();
-	memset(channel.data, defval, volume);
+	update_summary_uniform(channel_index, defval);
 }
 
 void VoxelBuffer::fill_area(int defval, Vector3i min, Vector3i max, unsigned int channel_index) {
@@ -139,18 +211,11 @@ void VoxelBuffer::fill_area(int defval, Vector3i min, Vector3i max, unsigned int
 		if (channel.defval == defval)
 			return;
 		else
-			create_channel(channel_index, _size);
+			create_channel(channel_index, _size, channel.defval);
 	}
 
-	Vector3i pos;
-	int volume = get_volume();
-	for (pos.z = min.z; pos.z < max.z; ++pos.z) {
-		for (pos.x = min.x; pos.x < max.x; ++pos.x) {
-			unsigned int dst_ri = index(pos.x, pos.y + min.y, pos.z);
-			CRASH_COND(dst_ri >= volume);
-			memset(&channel.data[dst_ri], defval, area_size.y * sizeof(uint8_t));
-		}
-	}
+	fill_area_raw(channel.data, _size, min, area_size, defval);
+	_summary.valid = false;
 }
 
 bool VoxelBuffer::is_uniform(unsigned int channel_index) const {
@@ -162,15 +227,35 @@ bool VoxelBuffer::is_uniform(unsigned int channel_index) const {
 		return true;
 
 	// Channel isn't optimized, so must look at each voxel
-	uint8_t voxel = channel.data[0];
-	unsigned int volume = get_volume();
-	for (unsigned int i = 1; i < volume; ++i) {
-		if (channel.data[i] != voxel) {
-			return false;
-		}
+	return VoxelSimd::is_uniform(channel.data, get_volume());
+}
+
+void VoxelBuffer::get_channel_min_max(unsigned int channel_index, int &out_min, int &out_max) const {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+
+	const Channel &channel = _channels[channel_index];
+	if (channel.data == NULL) {
+		out_min = channel.defval;
+		out_max = channel.defval;
+		return;
 	}
 
-	return true;
+	uint8_t min, max;
+	VoxelSimd::get_min_max(channel.data, get_volume(), min, max);
+	out_min = min;
+	out_max = max;
+}
+
+void VoxelBuffer::get_channel_histogram(unsigned int channel_index, uint32_t counts[256]) const {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+
+	const Channel &channel = _channels[channel_index];
+	if (channel.data == NULL) {
+		counts[channel.defval] += get_volume();
+		return;
+	}
+
+	VoxelSimd::add_histogram(channel.data, get_volume(), counts);
 }
 
 void VoxelBuffer::optimize() {
@@ -183,7 +268,7 @@ void VoxelBuffer::optimize() {
 
 void VoxelBuffer::copy_from(const VoxelBuffer &other, unsigned int channel_index) {
 	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
-	ERR_FAIL_COND(other._size == _size);
+	ERR_FAIL_COND(other._size != _size);
 
 	Channel &channel = _channels[channel_index];
 	const Channel &other_channel = other._channels[channel_index];
@@ -198,6 +283,17 @@ void VoxelBuffer::copy_from(const VoxelBuffer &other, unsigned int channel_index
 	}
 
 	channel.defval = other_channel.defval;
+
+	if (_summary.valid && other._summary.valid) {
+		_summary.min[channel_index] = other._summary.min[channel_index];
+		_summary.max[channel_index] = other._summary.max[channel_index];
+		if (channel_index == Voxel::CHANNEL_TYPE) {
+			_summary.non_air_count = other._summary.non_air_count;
+			_summary.full_sides = other._summary.full_sides;
+		}
+	} else {
+		_summary.valid = false;
+	}
 }
 
 void VoxelBuffer::copy_from(const VoxelBuffer &other, Vector3i src_min, Vector3i src_max, Vector3i dst_min, unsigned int channel_index) {
@@ -221,32 +317,142 @@ void VoxelBuffer::copy_from(const VoxelBuffer &other, Vector3i src_min, Vector3i
 	} else {
 		if (other_channel.data) {
 			if (channel.data == NULL) {
-				create_channel(channel_index, _size);
-			}
-			// Copy row by row
-			Vector3i pos;
-			for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
-				for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
-					// Row direction is Y
-					unsigned int src_ri = other.index(pos.x + src_min.x, pos.y + src_min.y, pos.z + src_min.z);
-					unsigned int dst_ri = index(pos.x + dst_min.x, pos.y + dst_min.y, pos.z + dst_min.z);
-					memcpy(&channel.data[dst_ri], &other_channel.data[src_ri], area_size.y * sizeof(uint8_t));
-				}
+				create_channel(channel_index, _size, channel.defval);
 			}
-		} else if (channel.defval != other_channel.defval) {
+			copy_area_raw(other_channel.data, other._size, src_min, channel.data, _size, dst_min, area_size);
+
+		} else if (channel.data != NULL || channel.defval != other_channel.defval) {
 			if (channel.data == NULL) {
-				create_channel(channel_index, _size);
+				create_channel(channel_index, _size, channel.defval);
 			}
-			// Set row by row
-			Vector3i pos;
-			for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
-				for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
-					unsigned int dst_ri = index(pos.x + dst_min.x, pos.y + dst_min.y, pos.z + dst_min.z);
-					memset(&channel.data[dst_ri], other_channel.defval, area_size.y * sizeof(uint8_t));
-				}
+			fill_area_raw(channel.data, _size, dst_min, area_size, other_channel.defval);
+		}
+		_summary.valid = false;
+	}
+}
+
+// Tells if all voxels on a side of the buffer are not zero
+static bool is_side_full(const uint8_t *data, Vector3i size, Cube::Side side) {
+
+	Vector3i min(0, 0, 0);
+	Vector3i max = size;
+	const Vector3i normal = Cube::g_side_normals[side];
+	for (unsigned int axis = 0; axis < 3; ++axis) {
+		if (normal[axis] > 0)
+			min[axis] = size[axis] - 1;
+		else if (normal[axis] < 0)
+			max[axis] = 1;
+	}
+
+	for (int z = min.z; z < max.z; ++z) {
+		for (int x = min.x; x < max.x; ++x) {
+			const uint8_t *row = data + (z * size.x + x) * size.y;
+			for (int y = min.y; y < max.y; ++y) {
+				if (row[y] == 0)
+					return false;
 			}
 		}
 	}
+	return true;
+}
+
+void VoxelBuffer::compute_summary() {
+
+	const unsigned int volume = get_volume();
+
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		const Channel &channel = _channels[i];
+		if (channel.data == NULL || volume == 0) {
+			_summary.min[i] = channel.defval;
+			_summary.max[i] = channel.defval;
+		} else {
+			VoxelSimd::get_min_max(channel.data, volume, _summary.min[i], _summary.max[i]);
+		}
+	}
+
+	const unsigned int type_channel = Voxel::CHANNEL_TYPE;
+	const uint8_t *types = _channels[type_channel].data;
+
+	if (volume == 0 || _summary.max[type_channel] == 0) {
+		_summary.non_air_count = 0;
+		_summary.full_sides = 0;
+
+	} else if (_summary.min[type_channel] != 0) {
+		_summary.non_air_count = volume;
+		_summary.full_sides = (1 << Cube::SIDE_COUNT) - 1;
+
+	} else {
+		// Mixed, only happens if data is allocated
+		uint32_t air_count = 0;
+		for (unsigned int i = 0; i < volume; ++i) {
+			air_count += types[i] == 0;
+		}
+		_summary.non_air_count = volume - air_count;
+
+		_summary.full_sides = 0;
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+			if (is_side_full(types, _size, (Cube::Side)side))
+				_summary.full_sides |= (1 << side);
+		}
+	}
+
+	_summary.valid = true;
+}
+
+void VoxelBuffer::update_summary(unsigned int channel_index, int x, int y, int z, uint8_t old_value, uint8_t new_value) {
+
+	if (!_summary.valid)
+		return;
+
+	// Without scanning, it's not known if the old value was the only one at a bound, so bounds can only get wider
+	if (new_value < _summary.min[channel_index])
+		_summary.min[channel_index] = new_value;
+	if (new_value > _summary.max[channel_index])
+		_summary.max[channel_index] = new_value;
+
+	if (channel_index != Voxel::CHANNEL_TYPE)
+		return;
+
+	if (old_value == 0 && new_value != 0) {
+		++_summary.non_air_count;
+
+	} else if (old_value != 0 && new_value == 0) {
+		--_summary.non_air_count;
+
+		// A side becoming full again needs a scan, so only clearing is done here
+		if (_summary.full_sides != 0) {
+			uint8_t sides = 0;
+			if (x == 0)
+				sides |= (1 << Cube::SIDE_RIGHT);
+			if (x == _size.x - 1)
+				sides |= (1 << Cube::SIDE_LEFT);
+			if (y == 0)
+				sides |= (1 << Cube::SIDE_BOTTOM);
+			if (y == _size.y - 1)
+				sides |= (1 << Cube::SIDE_TOP);
+			if (z == 0)
+				sides |= (1 << Cube::SIDE_BACK);
+			if (z == _size.z - 1)
+				sides |= (1 << Cube::SIDE_FRONT);
+			_summary.full_sides &= ~sides;
+		}
+	}
+}
+
+// The whole channel got the same value, so the summary of that channel is exact
+void VoxelBuffer::update_summary_uniform(unsigned int channel_index, uint8_t value) {
+
+	if (!_summary.valid)
+		return;
+
+	_summary.min[channel_index] = value;
+	_summary.max[channel_index] = value;
+
+	if (channel_index == Voxel::CHANNEL_TYPE) {
+		const unsigned int volume = get_volume();
+		_summary.non_air_count = value != 0 ? volume : 0;
+		_summary.full_sides = value != 0 && volume != 0 ? (1 << Cube::SIDE_COUNT) - 1 : 0;
+	}
 }
 
 uint8_t *VoxelBuffer::get_channel_raw(unsigned int channel_index) const {
@@ -255,15 +461,39 @@ uint8_t *VoxelBuffer::get_channel_raw(unsigned int channel_index) const {
 	return channel.data;
 }
 
+void VoxelBuffer::decompress_channel(unsigned int channel_index) {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	Channel &channel = _channels[channel_index];
+	if (channel.data == NULL) {
+		create_channel(channel_index, _size, channel.defval);
+	}
+}
+
+size_t VoxelBuffer::get_memory_usage() const {
+	size_t size = 0;
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		size += get_channel_memory_usage(i);
+	}
+	return size;
+}
+
+size_t VoxelBuffer::get_channel_memory_usage(unsigned int channel_index) const {
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, 0);
+	return _channels[channel_index].data ? get_volume() * sizeof(uint8_t) : 0;
+}
+
 void VoxelBuffer::create_channel(int i, Vector3i size, uint8_t defval) {
 	create_channel_noinit(i, size);
-	memset(_channels[i].data, defval, get_volume() * sizeof(uint8_t));
+	// The buffer may be resizing, so its current volume can differ
+	memset(_channels[i].data, defval, size.x * size.y * size.z * sizeof(uint8_t));
 }
 
 void VoxelBuffer::create_channel_noinit(int i, Vector3i size) {
 	Channel &channel = _channels[i];
 	unsigned int volume = size.x * size.y * size.z;
 	channel.data = (uint8_t *)memalloc(volume * sizeof(uint8_t));
+	VoxelPerformance::increment(VoxelPerformance::CHANNEL_MEMORY, volume * sizeof(uint8_t));
+	VoxelPerformance::update_peak(VoxelPerformance::CHANNEL_MEMORY_PEAK, VoxelPerformance::CHANNEL_MEMORY);
 }
 
 void VoxelBuffer::delete_channel(int i) {
@@ -271,6 +501,7 @@ void VoxelBuffer::delete_channel(int i) {
 	ERR_FAIL_COND(channel.data == NULL);
 	memfree(channel.data);
 	channel.data = NULL;
+	VoxelPerformance::decrement(VoxelPerformance::CHANNEL_MEMORY, get_volume() * sizeof(uint8_t));
 }
 
 void VoxelBuffer::_bind_methods() {
@@ -295,6 +526,8 @@ void VoxelBuffer::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD("is_uniform", "channel"), &VoxelBuffer::is_uniform, DEFVAL(0));
 	ClassDB::bind_method(D_METHOD("optimize"), &VoxelBuffer::optimize);
+	ClassDB::bind_method(D_METHOD("get_memory_usage"), &VoxelBuffer::_get_memory_usage_binding);
+	ClassDB::bind_method(D_METHOD("get_channel_memory_usage", "channel"), &VoxelBuffer::_get_channel_memory_usage_binding);
 }
 
 void VoxelBuffer::_copy_from_binding(Ref<VoxelBuffer> other, unsigned int channel) {
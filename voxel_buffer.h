@@ -16,6 +16,21 @@ public:
 	// Arbitrary value, 8 should be enough. Tweak for your needs.
 	static const int MAX_CHANNELS = 8;
 
+	// Facts about the voxels, so they don't have to be found again by scanning them.
+	// compute_summary() finds them exactly. Writes through this class keep them valid, but some of them only widen
+	// min and max, which can then be wider than actual values.
+	// Writes to raw channel data don't update it, so compute_summary() must be called after them.
+	struct Summary {
+		uint8_t min[MAX_CHANNELS];
+		uint8_t max[MAX_CHANNELS];
+		// Voxels of the type channel which are not air
+		uint32_t non_air_count;
+		// Bit (1 << Cube::Side) is set if all voxels of the type channel on that side of the buffer are not air
+		uint8_t full_sides;
+		// If false, nothing above can be trusted
+		bool valid;
+	};
+
 	// Converts -1..1 float into 0..255 integer
 	static inline int iso_to_byte(real_t iso) {
 		int v = static_cast<int>(128.f * iso + 128.f);
@@ -59,21 +74,29 @@ public:
 
 	bool is_uniform(unsigned int channel_index = 0) const;
 
+	// Lowest and highest values of a channel
+	void get_channel_min_max(unsigned int channel_index, int &out_min, int &out_max) const;
+	// Counts how many voxels have each value, adding them to `counts`
+	void get_channel_histogram(unsigned int channel_index, uint32_t counts[256]) const;
+
 	void optimize();
 
+	void compute_summary();
+	_FORCE_INLINE_ const Summary &get_summary() const { return _summary; }
+
 	void copy_from(const VoxelBuffer &other, unsigned int channel_index = 0);
 	void copy_from(const VoxelBuffer &other, Vector3i src_min, Vector3i src_max, Vector3i dst_min, unsigned int channel_index = 0);
 
 	_FORCE_INLINE_ bool validate_pos(unsigned int x, unsigned int y, unsigned int z) const {
-		return x < _size.x && y < _size.y && z < _size.x;
+		return x < _size.x && y < _size.y && z < _size.z;
 	}
 
 	_FORCE_INLINE_ unsigned int index(unsigned int x, unsigned int y, unsigned int z) const {
-		return (z * _size.z + x) * _size.x + y;
+		return (z * _size.x + x) * _size.y + y;
 	}
 
 	_FORCE_INLINE_ unsigned int row_index(unsigned int x, unsigned int y, unsigned int z) const {
-		return (z * _size.z + x) * _size.x;
+		return (z * _size.x + x) * _size.y;
 	}
 
 	_FORCE_INLINE_ unsigned int get_volume() const {
@@ -82,10 +105,19 @@ public:
 
 	uint8_t *get_channel_raw(unsigned int channel_index) const;
 
+	// Allocates the channel if it is uniform, so it can be accessed with get_channel_raw()
+	void decompress_channel(unsigned int channel_index);
+
+	// Bytes allocated for voxel data. Uniform channels don't count.
+	size_t get_memory_usage() const;
+	size_t get_channel_memory_usage(unsigned int channel_index) const;
+
 private:
 	void create_channel_noinit(int i, Vector3i size);
 	void create_channel(int i, Vector3i size, uint8_t defval = 0);
 	void delete_channel(int i);
+	void update_summary(unsigned int channel_index, int x, int y, int z, uint8_t old_value, uint8_t new_value);
+	void update_summary_uniform(unsigned int channel_index, uint8_t value);
 
 protected:
 	static void _bind_methods();
@@ -99,6 +131,8 @@ protected:
 	void _copy_from_binding(Ref<VoxelBuffer> other, unsigned int channel);
 	void _copy_from_area_binding(Ref<VoxelBuffer> other, Vector3 src_min, Vector3 src_max, Vector3 dst_min, unsigned int channel);
 	_FORCE_INLINE_ void _fill_area_binding(int defval, Vector3 min, Vector3 max, unsigned int channel_index) { fill_area(defval, Vector3i(min), Vector3i(max), channel_index); }
+	_FORCE_INLINE_ int _get_memory_usage_binding() const { return get_memory_usage(); }
+	_FORCE_INLINE_ int _get_channel_memory_usage_binding(unsigned int channel) const { return get_channel_memory_usage(channel); }
 	_FORCE_INLINE_ void _set_voxel_iso_binding(real_t value, int x, int y, int z, unsigned int channel) { set_voxel_iso(value, x, y, z, channel); }
 
 private:
@@ -120,6 +154,8 @@ private:
 
 	// How many voxels are there in the three directions. All populated channels have the same size.
 	Vector3i _size;
+
+	Summary _summary;
 };
 
 #endif // VOXEL_BUFFER_H
@@ -0,0 +1,164 @@
+#include "voxel_collision_builder.h"
+#include <core/math/math_funcs.h>
+#include <scene/resources/mesh.h>
+#include <string.h>
+
+// Tracks which voxels of the area have already been merged into a box.
+// Data is in the same [z][x][y] order as VoxelBuffer.
+struct GreedyBoxContext {
+	const VoxelBuffer &buffer;
+	const uint8_t *data;
+	uint8_t *covered;
+	Vector3i min;
+	Vector3i size;
+
+	GreedyBoxContext(const VoxelBuffer &p_buffer, const uint8_t *p_data, uint8_t *p_covered, Vector3i p_min, Vector3i p_size)
+		: buffer(p_buffer), data(p_data), covered(p_covered), min(p_min), size(p_size) {}
+
+	_FORCE_INLINE_ unsigned int local_index(int x, int y, int z) const {
+		return (z * size.x + x) * size.y + y;
+	}
+
+	_FORCE_INLINE_ bool is_free(int x, int y, int z) const {
+		return data[buffer.index(min.x + x, min.y + y, min.z + z)] != 0 && covered[local_index(x, y, z)] == 0;
+	}
+
+	bool is_row_free(int x, int y0, int y1, int z) const {
+		for (int y = y0; y < y1; ++y) {
+			if (!is_free(x, y, z))
+				return false;
+		}
+		return true;
+	}
+
+	bool is_rect_free(int x0, int x1, int y0, int y1, int z) const {
+		for (int x = x0; x < x1; ++x) {
+			if (!is_row_free(x, y0, y1, z))
+				return false;
+		}
+		return true;
+	}
+
+	void cover(Vector3i from, Vector3i to) {
+		for (int z = from.z; z < to.z; ++z) {
+			for (int x = from.x; x < to.x; ++x) {
+				memset(&covered[local_index(x, from.y, z)], 1, (to.y - from.y) * sizeof(uint8_t));
+			}
+		}
+	}
+};
+
+void build_voxel_collision_boxes(const VoxelBuffer &buffer, unsigned int channel, Vector3i min, Vector3i max,
+		Vector<AABB> &out_boxes, Vector<uint8_t> &temp_covered) {
+
+	ERR_FAIL_COND(channel >= VoxelBuffer::MAX_CHANNELS);
+
+	Vector3i::sort_min_max(min, max);
+	min.clamp_to(Vector3i(0, 0, 0), buffer.get_size());
+	max.clamp_to(min, buffer.get_size() + Vector3i(1, 1, 1));
+	const Vector3i size = max - min;
+
+	if (size.x == 0 || size.y == 0 || size.z == 0)
+		return;
+
+	const uint8_t *data = buffer.get_channel_raw(channel);
+
+	if (data == NULL) {
+		// Uniform channel, the whole area is either empty or solid
+		if (buffer.get_voxel(min, channel) != 0) {
+			out_boxes.push_back(AABB(Vector3(), size.to_vec3()));
+		}
+		return;
+	}
+
+	temp_covered.resize(size.volume());
+	memset(temp_covered.ptrw(), 0, temp_covered.size() * sizeof(uint8_t));
+
+	GreedyBoxContext ctx(buffer, data, temp_covered.ptrw(), min, size);
+
+	// Grow boxes along Y first, because it's the direction in which voxels are contiguous in memory,
+	// then along X and Z as long as the whole face of the box stays solid.
+	for (int z = 0; z < size.z; ++z) {
+		for (int x = 0; x < size.x; ++x) {
+			for (int y = 0; y < size.y; ++y) {
+
+				if (!ctx.is_free(x, y, z))
+					continue;
+
+				int ey = y + 1;
+				while (ey < size.y && ctx.is_free(x, ey, z))
+					++ey;
+
+				int ex = x + 1;
+				while (ex < size.x && ctx.is_row_free(ex, y, ey, z))
+					++ex;
+
+				int ez = z + 1;
+				while (ez < size.z && ctx.is_rect_free(x, ex, y, ey, ez))
+					++ez;
+
+				ctx.cover(Vector3i(x, y, z), Vector3i(ex, ey, ez));
+
+				out_boxes.push_back(AABB(Vector3(x, y, z), Vector3(ex - x, ey - y, ez - z)));
+
+				// No need to test voxels we just covered
+				y = ey - 1;
+			}
+		}
+	}
+}
+
+static inline Vector3 snap_to_cell(const Vector3 &v, real_t cell_size) {
+	return Vector3(
+			Math::round(v.x / cell_size) * cell_size,
+			Math::round(v.y / cell_size) * cell_size,
+			Math::round(v.z / cell_size) * cell_size);
+}
+
+void build_mesh_collision_faces(const Array &surfaces, real_t cell_size, PoolVector<Vector3> &out_faces) {
+
+	const bool decimate = cell_size > 0;
+
+	for (int i = 0; i < surfaces.size(); ++i) {
+
+		Array arrays = surfaces[i];
+		if (arrays.empty())
+			continue;
+
+		PoolVector<Vector3> vertices = arrays[Mesh::ARRAY_VERTEX];
+		PoolVector<int> indices = arrays[Mesh::ARRAY_INDEX];
+		if (indices.size() == 0)
+			continue;
+
+		// Allocate for the worst case, and shrink once triangles are known
+		int face_count = out_faces.size();
+		out_faces.resize(out_faces.size() + indices.size());
+
+		{
+			PoolVector<Vector3>::Write w = out_faces.write();
+			PoolVector<Vector3>::Read rv = vertices.read();
+			PoolVector<int>::Read ri = indices.read();
+
+			for (int j = 0; j + 2 < indices.size(); j += 3) {
+
+				Vector3 a = rv[ri[j]];
+				Vector3 b = rv[ri[j + 1]];
+				Vector3 c = rv[ri[j + 2]];
+
+				if (decimate) {
+					a = snap_to_cell(a, cell_size);
+					b = snap_to_cell(b, cell_size);
+					c = snap_to_cell(c, cell_size);
+					if (a == b || b == c || c == a)
+						continue;
+				}
+
+				w[face_count++] = a;
+				w[face_count++] = b;
+				w[face_count++] = c;
+			}
+		}
+
+		out_faces.resize(face_count);
+	}
+}
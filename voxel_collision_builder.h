@@ -0,0 +1,21 @@
+#ifndef VOXEL_COLLISION_BUILDER_H
+#define VOXEL_COLLISION_BUILDER_H
+
+#include "voxel_buffer.h"
+#include <core/math/aabb.h>
+#include <core/array.h>
+
+// Merges non-empty voxels of the [min, max[ area into as few boxes as possible, using a greedy approach.
+// Boxes are expressed relative to `min`, and are appended to `out_boxes`.
+// `temp_covered` is working memory, which can be kept between calls to avoid allocating it each time.
+void build_voxel_collision_boxes(const VoxelBuffer &buffer, unsigned int channel, Vector3i min, Vector3i max,
+		Vector<AABB> &out_boxes, Vector<uint8_t> &temp_covered);
+
+// Gathers triangles of mesh surfaces (as returned by mesher's build()) into a list of faces,
+// as expected by concave polygon shapes.
+// If `cell_size` is above zero, the mesh is decimated by snapping vertices to a grid of that size,
+// and triangles collapsing in the process are dropped. Vertices move by up to half a cell.
+// Cells should divide the block size, so vertices on borders snap the same way in neighbor blocks.
+void build_mesh_collision_faces(const Array &surfaces, real_t cell_size, PoolVector<Vector3> &out_faces);
+
+#endif // VOXEL_COLLISION_BUILDER_H
@@ -0,0 +1,176 @@
+#include "voxel_job_pool.h"
+#include "zprofiling.h"
+
+#include <core/os/os.h>
+
+VoxelJobPool *VoxelJobPool::g_singleton = NULL;
+
+void VoxelJobPool::create_singleton() {
+	ERR_FAIL_COND(g_singleton != NULL);
+	g_singleton = memnew(VoxelJobPool);
+}
+
+void VoxelJobPool::destroy_singleton() {
+	ERR_FAIL_COND(g_singleton == NULL);
+	memdelete(g_singleton);
+	g_singleton = NULL;
+}
+
+VoxelJobPool::VoxelJobPool() {
+
+	for (int i = 0; i < MAX_WORKERS; ++i)
+		_threads[i] = NULL;
+	_thread_count = 0;
+	_threads_started = false;
+
+	_run_mutex = Mutex::create();
+	_mutex = Mutex::create();
+	_func = NULL;
+	_data = NULL;
+	_job_count = 0;
+	_next_job = 0;
+	_pending_jobs = 0;
+	_thread_exit = false;
+
+	_work_semaphore = Semaphore::create();
+	_done_semaphore = Semaphore::create();
+}
+
+VoxelJobPool::~VoxelJobPool() {
+
+	{
+		MutexLock lock(_mutex);
+		_thread_exit = true;
+	}
+
+	for (int i = 0; i < _thread_count; ++i)
+		_work_semaphore->post();
+
+	for (int i = 0; i < _thread_count; ++i) {
+		Thread::wait_to_finish(_threads[i]);
+		memdelete(_threads[i]);
+	}
+
+	memdelete(_work_semaphore);
+	memdelete(_done_semaphore);
+	memdelete(_mutex);
+	memdelete(_run_mutex);
+}
+
+int VoxelJobPool::get_concurrency() const {
+	return CLAMP(OS::get_singleton()->get_processor_count(), 1, MAX_WORKERS + 1);
+}
+
+void VoxelJobPool::start_threads() {
+
+	// Must be called with the run mutex locked
+
+	_threads_started = true;
+
+	const int worker_count = get_concurrency() - 1;
+	for (int i = 0; i < worker_count; ++i) {
+		Thread *thread = Thread::create(_thread_func, this);
+		// Jobs still get done with fewer workers
+		if (thread == NULL)
+			break;
+		_threads[_thread_count] = thread;
+		++_thread_count;
+	}
+
+	if (_thread_count < worker_count) {
+		WARN_PRINTS("VoxelJobPool could only start " + itos(_thread_count) + " threads out of " + itos(worker_count));
+	}
+}
+
+void VoxelJobPool::run(JobFunc func, void *data, int job_count) {
+
+	ERR_FAIL_COND(func == NULL);
+	ERR_FAIL_COND(job_count < 0);
+
+	MutexLock run_lock(_run_mutex);
+
+	if (!_threads_started && job_count > 1)
+		start_threads();
+
+	if (_thread_count == 0 || job_count <= 1) {
+		for (int i = 0; i < job_count; ++i)
+			func(data, i);
+		return;
+	}
+
+	{
+		MutexLock lock(_mutex);
+		_func = func;
+		_data = data;
+		_job_count = job_count;
+		_next_job = 0;
+		_pending_jobs = job_count;
+	}
+
+	const int wake_count = MIN(job_count - 1, _thread_count);
+	for (int i = 0; i < wake_count; ++i)
+		_work_semaphore->post();
+
+	// Workers signal only if they finish the last job
+	if (!process_jobs())
+		_done_semaphore->wait();
+}
+
+// Takes jobs of the current batch until there are none left.
+// Returns true if the last job of the batch was finished by the caller.
+bool VoxelJobPool::process_jobs() {
+
+	bool finished_batch = false;
+
+	while (true) {
+
+		JobFunc func;
+		void *data;
+		int job_index;
+
+		{
+			MutexLock lock(_mutex);
+			if (_next_job >= _job_count)
+				break;
+			func = _func;
+			data = _data;
+			job_index = _next_job;
+			++_next_job;
+		}
+
+		func(data, job_index);
+
+		{
+			MutexLock lock(_mutex);
+			--_pending_jobs;
+			if (_pending_jobs == 0)
+				finished_batch = true;
+		}
+	}
+
+	return finished_batch;
+}
+
+void VoxelJobPool::_thread_func(void *p_self) {
+
+	VOXEL_PROFILE_THREAD_NAME("VoxelJobPool");
+
+	VoxelJobPool *self = reinterpret_cast<VoxelJobPool *>(p_self);
+
+	while (true) {
+
+		self->_work_semaphore->wait();
+
+		{
+			MutexLock lock(self->_mutex);
+			if (self->_thread_exit)
+				break;
+		}
+
+		// Workers woken after the batch was taken simply find nothing to do
+		if (self->process_jobs())
+			self->_done_semaphore->post();
+	}
+
+	VOXEL_PROFILE_THREAD_END();
+}
@@ -0,0 +1,61 @@
+#ifndef VOXEL_JOB_POOL_H
+#define VOXEL_JOB_POOL_H
+
+#include <core/os/mutex.h>
+#include <core/os/semaphore.h>
+#include <core/os/thread.h>
+
+// Runs batches of short jobs in parallel, for APIs processing many items in one call.
+// Worker threads are started the first time a batch runs and are kept until the pool is destroyed,
+// so a call doesn't pay for creating threads. The calling thread takes jobs too.
+// If workers can't be started, jobs run on the calling thread.
+class VoxelJobPool {
+public:
+	static const int MAX_WORKERS = 15;
+
+	typedef void (*JobFunc)(void *data, int job_index);
+
+	static void create_singleton();
+	static void destroy_singleton();
+	static VoxelJobPool *get_singleton() { return g_singleton; }
+
+	// Calls `func(data, i)` for each index from 0 to `job_count` - 1, and returns when all are done.
+	// Batches from different threads run one after the other.
+	// Jobs must not run batches themselves.
+	void run(JobFunc func, void *data, int job_count);
+
+	// How many jobs can run at the same time, counting the calling thread
+	int get_concurrency() const;
+
+private:
+	VoxelJobPool();
+	~VoxelJobPool();
+
+	void start_threads();
+	bool process_jobs();
+
+	static void _thread_func(void *p_self);
+
+	static VoxelJobPool *g_singleton;
+
+	Thread *_threads[MAX_WORKERS];
+	int _thread_count;
+	bool _threads_started;
+
+	// Only one batch runs at a time
+	Mutex *_run_mutex;
+
+	// Protects the current batch
+	Mutex *_mutex;
+	JobFunc _func;
+	void *_data;
+	int _job_count;
+	int _next_job;
+	int _pending_jobs;
+	bool _thread_exit;
+
+	Semaphore *_work_semaphore;
+	Semaphore *_done_semaphore;
+};
+
+#endif // VOXEL_JOB_POOL_H
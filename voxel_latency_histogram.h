@@ -0,0 +1,115 @@
+#ifndef VOXEL_LATENCY_HISTOGRAM_H
+#define VOXEL_LATENCY_HISTOGRAM_H
+
+#include <core/dictionary.h>
+#include <core/math/math_funcs.h>
+#include <core/typedefs.h>
+
+// Streaming histogram of durations, in the spirit of HdrHistogram.
+// Values are bucketed by their power of two, and each power of two is split in SUB_BUCKET_COUNT linear parts,
+// so percentiles have the same relative precision whatever their magnitude, using constant memory.
+class VoxelLatencyHistogram {
+public:
+	static const unsigned int SUB_BUCKET_BITS = 3;
+	static const unsigned int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+	// Enough for any 64-bit value
+	static const unsigned int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+	VoxelLatencyHistogram() {
+		clear();
+	}
+
+	void clear() {
+		for (unsigned int i = 0; i < BUCKET_COUNT; ++i)
+			_counts[i] = 0;
+		_count = 0;
+		_total = 0;
+		_min = 0;
+		_max = 0;
+	}
+
+	void add(uint64_t value) {
+		++_counts[get_bucket_index(value)];
+		if (_count == 0 || value < _min)
+			_min = value;
+		if (value > _max)
+			_max = value;
+		_total += value;
+		++_count;
+	}
+
+	// Gets the value below which `p` of values are, with `p` in [0, 1]
+	uint64_t get_percentile(float p) const {
+
+		if (_count == 0)
+			return 0;
+
+		const uint64_t target = MAX(uint64_t(1), uint64_t(Math::ceil(p * _count)));
+		uint64_t sum = 0;
+
+		for (unsigned int i = 0; i < BUCKET_COUNT; ++i) {
+			sum += _counts[i];
+			if (sum >= target) {
+				uint64_t width;
+				const uint64_t lower = get_bucket_lower_bound(i, width);
+				// Middle of the bucket, within what was actually recorded
+				return CLAMP(lower + width / 2, _min, _max);
+			}
+		}
+
+		return _max;
+	}
+
+	uint64_t get_count() const { return _count; }
+	uint64_t get_min() const { return _min; }
+	uint64_t get_max() const { return _max; }
+	uint64_t get_mean() const { return _count > 0 ? _total / _count : 0; }
+
+	Dictionary to_dictionary() const {
+		Dictionary d;
+		d["count"] = _count;
+		d["min"] = get_min();
+		d["max"] = get_max();
+		d["mean"] = get_mean();
+		d["p50"] = get_percentile(0.50);
+		d["p95"] = get_percentile(0.95);
+		d["p99"] = get_percentile(0.99);
+		return d;
+	}
+
+private:
+	static inline unsigned int get_bucket_index(uint64_t value) {
+
+		if (value < SUB_BUCKET_COUNT)
+			return value;
+
+		unsigned int exponent = 0;
+		for (uint64_t v = value >> 1; v != 0; v >>= 1)
+			++exponent;
+
+		const unsigned int shift = exponent - SUB_BUCKET_BITS;
+		const unsigned int mantissa = (value >> shift) & (SUB_BUCKET_COUNT - 1);
+		return (shift + 1) * SUB_BUCKET_COUNT + mantissa;
+	}
+
+	static inline uint64_t get_bucket_lower_bound(unsigned int index, uint64_t &out_width) {
+
+		if (index < SUB_BUCKET_COUNT) {
+			out_width = 1;
+			return index;
+		}
+
+		const unsigned int shift = index / SUB_BUCKET_COUNT - 1;
+		const unsigned int mantissa = index % SUB_BUCKET_COUNT;
+		out_width = uint64_t(1) << shift;
+		return uint64_t(SUB_BUCKET_COUNT + mantissa) << shift;
+	}
+
+	uint32_t _counts[BUCKET_COUNT];
+	uint64_t _count;
+	uint64_t _total;
+	uint64_t _min;
+	uint64_t _max;
+};
+
+#endif // VOXEL_LATENCY_HISTOGRAM_H
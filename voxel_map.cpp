@@ -64,7 +64,7 @@ void VoxelMap::set_default_voxel(int value, unsigned int channel) {
 	_default_voxel[channel] = value;
 }
 
-int VoxelMap::get_default_voxel(unsigned int channel) {
+int VoxelMap::get_default_voxel(unsigned int channel) const {
 	ERR_FAIL_INDEX_V(channel, VoxelBuffer::MAX_CHANNELS, 0);
 	return _default_voxel[channel];
 }
@@ -82,12 +82,35 @@ VoxelBlock *VoxelMap::get_block(Vector3i bpos) {
 	return NULL;
 }
 
+const VoxelBlock *VoxelMap::get_block(Vector3i bpos) const {
+	const VoxelBlock *const *p = _blocks.getptr(bpos);
+	if (p) {
+		return *p;
+	}
+	return NULL;
+}
+
 void VoxelMap::set_block(Vector3i bpos, VoxelBlock *block) {
 	ERR_FAIL_COND(block == NULL);
 	if (_last_accessed_block == NULL || _last_accessed_block->pos == bpos) {
 		_last_accessed_block = block;
 	}
 	_blocks.set(bpos, block);
+	block->loaded_neighbors = update_neighbor_counts(bpos, 1);
+}
+
+unsigned int VoxelMap::update_neighbor_counts(Vector3i bpos, int delta) {
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < Cube::MOORE_NEIGHBORING_3D_COUNT; ++i) {
+		VoxelBlock **pptr = _blocks.getptr(bpos + Cube::g_moore_neighboring_3d[i]);
+		if (pptr) {
+			VoxelBlock *neighbor = *pptr;
+			neighbor->loaded_neighbors += delta;
+			CRASH_COND(neighbor->loaded_neighbors > Cube::MOORE_NEIGHBORING_3D_COUNT);
+			++count;
+		}
+	}
+	return count;
 }
 
 void VoxelMap::set_block_buffer(Vector3i bpos, Ref<VoxelBuffer> buffer) {
@@ -106,13 +129,9 @@ bool VoxelMap::has_block(Vector3i pos) const {
 }
 
 bool VoxelMap::is_block_surrounded(Vector3i pos) const {
-	for (unsigned int i = 0; i < Cube::MOORE_NEIGHBORING_3D_COUNT; ++i) {
-		Vector3i bpos = pos + Cube::g_moore_neighboring_3d[i];
-		if (!has_block(bpos)) {
-			return false;
-		}
-	}
-	return true;
+	// Neighbor counts are maintained when blocks are added or removed, so we don't have to look them up
+	const VoxelBlock *const *pptr = _blocks.getptr(pos);
+	return pptr != NULL && (*pptr)->loaded_neighbors == Cube::MOORE_NEIGHBORING_3D_COUNT;
 }
 
 void VoxelMap::get_buffer_copy(Vector3i min_pos, VoxelBuffer &dst_buffer, unsigned int channels_mask) {
@@ -149,7 +168,8 @@ void VoxelMap::get_buffer_copy(Vector3i min_pos, VoxelBuffer &dst_buffer, unsign
 						dst_buffer.fill_area(
 								_default_voxel[channel],
 								offset - min_pos,
-								offset - min_pos + block_size_v);
+								offset - min_pos + block_size_v,
+								channel);
 					}
 				}
 			}
@@ -157,6 +177,50 @@ void VoxelMap::get_buffer_copy(Vector3i min_pos, VoxelBuffer &dst_buffer, unsign
 	}
 }
 
+Dictionary VoxelMap::get_memory_usage() const {
+
+	uint64_t channel_memory[VoxelBuffer::MAX_CHANNELS] = { 0 };
+	int uniform_channels[VoxelBuffer::MAX_CHANNELS] = { 0 };
+	uint64_t mesh_memory = 0;
+
+	const Vector3i *key = NULL;
+	while (key = _blocks.next(key)) {
+
+		const VoxelBlock *block = _blocks.get(*key);
+		mesh_memory += block->get_mesh_memory_usage();
+
+		if (block->voxels.is_null())
+			continue;
+
+		const VoxelBuffer &voxels = **block->voxels;
+		for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+			const size_t size = voxels.get_channel_memory_usage(i);
+			channel_memory[i] += size;
+			if (size == 0)
+				++uniform_channels[i];
+		}
+	}
+
+	Array channel_memory_array;
+	Array uniform_channels_array;
+	uint64_t total_channel_memory = 0;
+	for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+		channel_memory_array.append(channel_memory[i]);
+		uniform_channels_array.append(uniform_channels[i]);
+		total_channel_memory += channel_memory[i];
+	}
+
+	Dictionary d;
+	d["block_count"] = _blocks.size();
+	// Bytes allocated for each channel index
+	d["channel_memory"] = channel_memory_array;
+	// How many blocks have each channel uniform, which costs no memory
+	d["uniform_channels"] = uniform_channels_array;
+	d["total_channel_memory"] = total_channel_memory;
+	d["mesh_memory"] = mesh_memory;
+	return d;
+}
+
 void VoxelMap::clear() {
 	const Vector3i *key = NULL;
 	while (key = _blocks.next(key)) {
@@ -184,6 +248,7 @@ void VoxelMap::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("voxel_to_block", "voxel_pos"), &VoxelMap::_voxel_to_block_binding);
 	ClassDB::bind_method(D_METHOD("block_to_voxel", "block_pos"), &VoxelMap::_block_to_voxel_binding);
 	ClassDB::bind_method(D_METHOD("get_block_size"), &VoxelMap::get_block_size);
+	ClassDB::bind_method(D_METHOD("get_memory_usage"), &VoxelMap::get_memory_usage);
 
 	//ADD_PROPERTY(PropertyInfo(Variant::INT, "iterations"), _SCS("set_iterations"), _SCS("get_iterations"));
 }
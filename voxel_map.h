@@ -46,7 +46,7 @@ public:
 	void set_voxel(int value, Vector3i pos, unsigned int c = 0);
 
 	void set_default_voxel(int value, unsigned int channel = 0);
-	int get_default_voxel(unsigned int channel = 0);
+	int get_default_voxel(unsigned int channel = 0) const;
 
 	// Gets a copy of all voxels in the area starting at min_pos having the same size as dst_buffer.
 	void get_buffer_copy(Vector3i min_pos, VoxelBuffer &dst_buffer, unsigned int channels_mask = 1);
@@ -69,6 +69,7 @@ public:
 			pre_delete(block);
 			memdelete(block);
 			_blocks.erase(bpos);
+			update_neighbor_counts(bpos, -1);
 		}
 	}
 
@@ -103,12 +104,18 @@ public:
 	}*/
 
 	VoxelBlock *get_block(Vector3i bpos);
+	// Doesn't use the last accessed block cache, so it can be used from readers that don't modify the map
+	const VoxelBlock *get_block(Vector3i bpos) const;
 
 	bool has_block(Vector3i pos) const;
+	// Tests if a block is present and all its neighbors are too
 	bool is_block_surrounded(Vector3i pos) const;
 
 	void clear();
 
+	// Reports how much memory blocks use, computed by visiting all of them
+	Dictionary get_memory_usage() const;
+
 	template <typename Op_T>
 	void for_all_blocks(Op_T op) {
 		const Vector3i *key = NULL;
@@ -123,6 +130,10 @@ public:
 private:
 	void set_block(Vector3i bpos, VoxelBlock *block);
 
+	// Adds `delta` to the neighbor count of blocks around the given position.
+	// Returns how many neighbors were found.
+	unsigned int update_neighbor_counts(Vector3i bpos, int delta);
+
 	void set_block_size_pow2(unsigned int p);
 
 	static void _bind_methods();
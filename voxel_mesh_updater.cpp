@@ -1,5 +1,7 @@
 #include <core/os/os.h>
 #include "voxel_mesh_updater.h"
+#include "voxel_collision_builder.h"
+#include "zprofiling.h"
 #include "utility.h"
 
 VoxelMeshUpdater::VoxelMeshUpdater(Ref<VoxelLibrary> library, MeshingParams params) {
@@ -13,6 +15,7 @@ VoxelMeshUpdater::VoxelMeshUpdater(Ref<VoxelLibrary> library, MeshingParams para
 	_model_mesher->set_occlusion_darkness(params.baked_ao_darkness);
 
 	_smooth_mesher.instance();
+	_smooth_collision_cell_size = params.smooth_collision_cell_size;
 
 	_input_mutex = Mutex::create();
 	_output_mutex = Mutex::create();
@@ -22,11 +25,12 @@ VoxelMeshUpdater::VoxelMeshUpdater(Ref<VoxelLibrary> library, MeshingParams para
 	_thread = Thread::create(_thread_func, this);
 
 	_needs_sort = true;
+	_has_urgent_blocks = false;
 }
 
 VoxelMeshUpdater::~VoxelMeshUpdater() {
 
-	_thread_exit = true;
+	request_exit();
 	_semaphore->post();
 	Thread::wait_to_finish(_thread);
 	memdelete(_thread);
@@ -47,20 +51,10 @@ void VoxelMeshUpdater::push(const Input &input) {
 
 			Vector3i pos = input.blocks[i].position;
 
-			// If a block is exactly on the priority position, update it instantly on the main thread
-			// This is to eliminate latency for player's actions, assuming updating a block isn't slower than a frame
-			/*if (pos == _shared_input.priority_position) {
-
-				OutputBlock ob;
-				process_block(_shared_input.blocks[i], ob);
-
-				{
-					MutexLock lock2(_output_mutex);
-					_shared_output.blocks.push_back(ob);
-				}
-
-				continue;
-			}*/
+			if (input.blocks[i].urgent) {
+				// The thread will pick it up after the block it's currently processing
+				_has_urgent_blocks = true;
+			}
 
 			int *index = _block_indexes.getptr(pos);
 
@@ -77,11 +71,11 @@ void VoxelMeshUpdater::push(const Input &input) {
 			}
 		}
 
-		if(_shared_input.priority_position != input.priority_position || input.blocks.size() > 0) {
+		if(_shared_input.priority != input.priority || input.blocks.size() > 0) {
 			_needs_sort = true;
 		}
 
-		_shared_input.priority_position = input.priority_position;
+		_shared_input.priority = input.priority;
 		should_run = !_shared_input.is_empty();
 	}
 
@@ -93,6 +87,16 @@ void VoxelMeshUpdater::push(const Input &input) {
 	}
 }
 
+void VoxelMeshUpdater::request_exit() {
+	MutexLock lock(_input_mutex);
+	_thread_exit = true;
+}
+
+bool VoxelMeshUpdater::is_exit_requested() const {
+	MutexLock lock(_input_mutex);
+	return _thread_exit;
+}
+
 void VoxelMeshUpdater::pop(Output &output) {
 
 	MutexLock lock(_output_mutex);
@@ -109,7 +113,9 @@ void VoxelMeshUpdater::_thread_func(void *p_self) {
 
 void VoxelMeshUpdater::thread_func() {
 
-	while (!_thread_exit) {
+	VOXEL_PROFILE_THREAD_NAME("VoxelMeshUpdater");
+
+	while (!is_exit_requested()) {
 
 		uint32_t sync_interval = 50.0; // milliseconds
 		uint32_t sync_time = OS::get_singleton()->get_ticks_msec() + sync_interval;
@@ -119,7 +125,9 @@ void VoxelMeshUpdater::thread_func() {
 
 		thread_sync(queue_index, stats);
 
-		while (!_input.blocks.empty() && !_thread_exit) {
+		bool exit_requested = false;
+
+		while (!_input.blocks.empty() && !exit_requested) {
 
 			if (!_input.blocks.empty()) {
 
@@ -134,8 +142,13 @@ void VoxelMeshUpdater::thread_func() {
 
 				OutputBlock ob;
 				process_block(block, ob);
+				ob.urgent = block.urgent;
 
 				uint64_t time_taken = OS::get_singleton()->get_ticks_usec() - time_before;
+				ob.request_time = block.request_time;
+				ob.sequence = block.sequence;
+				ob.begin_time = time_before;
+				ob.end_time = time_before + time_taken;
 
 				// Do some stats
 				if (stats.first) {
@@ -150,6 +163,20 @@ void VoxelMeshUpdater::thread_func() {
 				}
 
 				_output.blocks.push_back(ob);
+
+				if (block.urgent) {
+					// Don't wait for the sync interval
+					sync_time = 0;
+				}
+			}
+
+			{
+				MutexLock lock(_input_mutex);
+				if (_has_urgent_blocks) {
+					// Get them now so they go before the rest of the queue
+					sync_time = 0;
+				}
+				exit_requested = _thread_exit;
 			}
 
 			uint32_t time = OS::get_singleton()->get_ticks_msec();
@@ -163,34 +190,61 @@ void VoxelMeshUpdater::thread_func() {
 			}
 		}
 
-		if (_thread_exit)
+		if (is_exit_requested())
 			break;
 
 		// Wait for future wake-up
 		_semaphore->wait();
 	}
+
+	VOXEL_PROFILE_THREAD_END();
 }
 
 void VoxelMeshUpdater::process_block(const InputBlock &block, OutputBlock &output) {
 
+	VOXEL_PROFILE_SCOPE_ID("VoxelMeshUpdater process block", ZProfiler::get_block_correlation_id(block.position));
+
 	CRASH_COND(block.voxels.is_null());
 
-	// Build cubic parts of the mesh
-	output.model_surfaces = _model_mesher->build(**block.voxels, Voxel::CHANNEL_TYPE, Vector3i(0, 0, 0), block.voxels->get_size() - Vector3(1, 1, 1));
-	// Build smooth parts of the mesh
-	output.smooth_surfaces = _smooth_mesher->build(**block.voxels, Voxel::CHANNEL_ISOLEVEL);
+	Array smooth_surfaces;
+	if (block.mesh_smooth && (block.build_mesh || block.build_collision)) {
+		// Smooth parts are needed by both rendering and collision
+		smooth_surfaces = _smooth_mesher->build(**block.voxels, Voxel::CHANNEL_ISOLEVEL);
+	}
+
+	if (block.build_mesh) {
+		if (block.mesh_model) {
+			// Build cubic parts of the mesh
+			output.model_surfaces = _model_mesher->build(**block.voxels, Voxel::CHANNEL_TYPE, Vector3i(0, 0, 0), block.voxels->get_size() - Vector3(1, 1, 1));
+		}
+		output.smooth_surfaces = smooth_surfaces;
+		if (block.build_side_connections) {
+			// Smooth voxels are not taken into account, so they never hide blocks
+			output.side_connections = build_voxel_side_connections(**block.voxels, Voxel::CHANNEL_TYPE, **_model_mesher->get_library(),
+					Vector3i(1, 1, 1), block.voxels->get_size() - Vector3i(2, 2, 2), _visibility_visited, _visibility_stack);
+		}
+	}
+
+	if (block.build_collision) {
+		// Cubic voxels collide as merged boxes, so we don't need their render geometry.
+		// The padding is excluded, it belongs to neighbor blocks.
+		const Vector3i pad(1, 1, 1);
+		build_voxel_collision_boxes(**block.voxels, Voxel::CHANNEL_TYPE, pad, block.voxels->get_size() - Vector3i(2, 2, 2), output.collision_boxes, _collision_covered);
+		// Smooth voxels use their mesh, decimated
+		build_mesh_collision_faces(smooth_surfaces, _smooth_collision_cell_size, output.collision_faces);
+		output.has_collision = true;
+	}
 
 	output.position = block.position;
 }
 
-// Sorts distance to viewer
-// The closest block will be the first one in the array
-struct BlockUpdateComparator {
-	Vector3i center;
-	inline bool operator()(const VoxelMeshUpdater::InputBlock &a, const VoxelMeshUpdater::InputBlock &b) const {
-		return a.position.distance_sq(center) < b.position.distance_sq(center);
-	}
-};
+static inline Vector3i get_block_position(const VoxelMeshUpdater::InputBlock &block) {
+	return block.position;
+}
+
+static inline bool is_block_urgent(const VoxelMeshUpdater::InputBlock &block) {
+	return block.urgent;
+}
 
 void VoxelMeshUpdater::thread_sync(int queue_index, Stats stats) {
 
@@ -209,21 +263,42 @@ void VoxelMeshUpdater::thread_sync(int queue_index, Stats stats) {
 
 	stats.remaining_blocks = _input.blocks.size();
 	bool needs_sort;
+	Vector<InputBlock> new_blocks;
 
 	{
 		// Get input
 		MutexLock lock(_input_mutex);
 
-		_input.blocks.append_array(_shared_input.blocks);
-		_input.priority_position = _shared_input.priority_position;
+		new_blocks = _shared_input.blocks;
+		_input.priority = _shared_input.priority;
 
 		_shared_input.blocks.clear();
 		_block_indexes.clear();
+		_has_urgent_blocks = false;
 
 		needs_sort = _needs_sort;
 		_needs_sort = false;
 	}
 
+	if (!new_blocks.empty()) {
+		// A block pushed again replaces its older request still waiting here.
+		// Otherwise both would be processed, and the older one could be applied last.
+		HashMap<Vector3i, int, Vector3iHasher> indexes;
+		for (int i = 0; i < _input.blocks.size(); ++i) {
+			indexes[_input.blocks[i].position] = i;
+		}
+		for (int i = 0; i < new_blocks.size(); ++i) {
+			const InputBlock &block = new_blocks[i];
+			const int *index = indexes.getptr(block.position);
+			if (index) {
+				_input.blocks.write[*index] = block;
+			} else {
+				indexes[block.position] = _input.blocks.size();
+				_input.blocks.push_back(block);
+			}
+		}
+	}
+
 	if(!_output.blocks.empty()) {
 
 //		print_line(String("VoxelMeshUpdater: posting {0} blocks, {1} remaining ; cost [{2}..{3}] usec")
@@ -237,11 +312,8 @@ void VoxelMeshUpdater::thread_sync(int queue_index, Stats stats) {
 	}
 
 	if (!_input.blocks.empty() && needs_sort) {
-		// Re-sort priority
-
-		SortArray<VoxelMeshUpdater::InputBlock, BlockUpdateComparator> sorter;
-		sorter.compare.center = _input.priority_position;
-		sorter.sort(_input.blocks.ptrw(), _input.blocks.size());
+		// Re-sort priority, the most urgent block will be the first one in the array
+		_input.priority.sort(_input.blocks, get_block_position, is_block_urgent);
 	}
 }
 
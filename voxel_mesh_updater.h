@@ -4,9 +4,12 @@
 #include <core/vector.h>
 #include <core/os/semaphore.h>
 #include <core/os/thread.h>
+#include <core/math/aabb.h>
 
 #include "voxel_buffer.h"
+#include "voxel_block_priority.h"
 #include "voxel_mesher.h"
+#include "voxel_visibility_builder.h"
 #include "transvoxel/voxel_mesher_smooth.h"
 
 class VoxelMeshUpdater {
@@ -14,11 +17,28 @@ public:
 	struct InputBlock {
 		Ref<VoxelBuffer> voxels;
 		Vector3i position;
+		// If false, only collision is built
+		bool build_mesh;
+		bool build_collision;
+		// Meshers can be skipped when the terrain knows they would produce nothing
+		bool mesh_model;
+		bool mesh_smooth;
+		// Only needed for cave culling, otherwise all sides are reported connected
+		bool build_side_connections;
+		// Urgent blocks are processed before others and sent back as soon as they are done
+		bool urgent;
+		// When the update was requested, in microseconds
+		uint64_t request_time;
+		// Given by the terrain, and copied to the output, so results of older requests can be recognized
+		uint32_t sequence;
+
+		InputBlock() : build_mesh(true), build_collision(false), mesh_model(true), mesh_smooth(true), build_side_connections(false), urgent(false), request_time(0), sequence(0) {}
 	};
 
 	struct Input {
 		Vector<InputBlock> blocks;
-		Vector3i priority_position;
+		// Tells which blocks to update first
+		VoxelBlockPriority priority;
 
 		bool is_empty() const {
 			return blocks.empty();
@@ -26,9 +46,25 @@ public:
 	};
 
 	struct OutputBlock {
+		// Only filled if a mesh was requested
 		Array model_surfaces;
 		Array smooth_surfaces;
 		Vector3i position;
+		bool urgent;
+		// Only filled if a mesh and side connections were requested. See build_voxel_side_connections().
+		uint64_t side_connections;
+		// When the update was requested, and when the updater started and finished processing it, in microseconds
+		uint64_t request_time;
+		uint64_t begin_time;
+		uint64_t end_time;
+		uint32_t sequence;
+
+		// Only filled if collision was requested
+		bool has_collision;
+		Vector<AABB> collision_boxes;
+		PoolVector<Vector3> collision_faces;
+
+		OutputBlock() : urgent(false), side_connections(VOXEL_ALL_SIDES_CONNECTED), request_time(0), begin_time(0), end_time(0), sequence(0), has_collision(false) {}
 	};
 
 	struct Stats {
@@ -48,8 +84,10 @@ public:
 	struct MeshingParams {
 		bool baked_ao;
 		float baked_ao_darkness;
+		// Grid size used to decimate smooth collision meshes, in voxels. Zero keeps them as rendered.
+		float smooth_collision_cell_size;
 
-		MeshingParams(): baked_ao(true), baked_ao_darkness(0.75)
+		MeshingParams(): baked_ao(true), baked_ao_darkness(0.75), smooth_collision_cell_size(0.5)
 		{ }
 	};
 
@@ -65,6 +103,10 @@ private:
 
 	void thread_sync(int queue_index, Stats stats);
 
+	// The flag is shared with the thread, so it is only accessed under lock
+	void request_exit();
+	bool is_exit_requested() const;
+
 	void process_block(const InputBlock &block, OutputBlock &output);
 
 private:
@@ -72,12 +114,19 @@ private:
 	Mutex *_input_mutex;
 	HashMap<Vector3i, int, Vector3iHasher> _block_indexes;
 	bool _needs_sort;
+	bool _has_urgent_blocks;
 
 	Output _shared_output;
 	Mutex *_output_mutex;
 
 	Ref<VoxelMesher> _model_mesher;
 	Ref<VoxelMesherSmooth> _smooth_mesher;
+	float _smooth_collision_cell_size;
+	// Working memory of the collision builder, kept between blocks
+	Vector<uint8_t> _collision_covered;
+	// Working memory of the visibility builder, kept between blocks
+	Vector<uint8_t> _visibility_visited;
+	Vector<unsigned int> _visibility_stack;
 
 	Input _input;
 	Output _output;
@@ -77,6 +77,7 @@ Ref<ArrayMesh> VoxelMesher::build_mesh(Ref<VoxelBuffer> buffer_ref, unsigned int
 }
 
 Array VoxelMesher::build(const VoxelBuffer &buffer, unsigned int channel, Vector3i min, Vector3i max) {
+	VOXEL_PROFILE_SCOPE("VoxelMesher::build");
 	uint64_t time_before = OS::get_singleton()->get_ticks_usec();
 
 	ERR_FAIL_COND_V(_library.is_null(), Array());
@@ -47,8 +47,8 @@ private:
 	bool _bake_occlusion;
 
 #ifdef VOXEL_PROFILING
-	ZProfiler _zprofiler;
-	Dictionary get_profiling_info() const { return _zprofiler.get_all_serialized_info(); }
+	// Zones are shared by all meshers and threads
+	Dictionary get_profiling_info() const { return ZProfiler::get_singleton()->get_all_serialized_info(); }
 #endif
 };
 
@@ -0,0 +1,69 @@
+#include "voxel_performance.h"
+
+VoxelPerformance *VoxelPerformance::g_singleton = NULL;
+uint64_t VoxelPerformance::g_values[VoxelPerformance::MONITOR_MAX] = { 0 };
+
+void VoxelPerformance::create_singleton() {
+	ERR_FAIL_COND(g_singleton != NULL);
+	g_singleton = memnew(VoxelPerformance);
+}
+
+void VoxelPerformance::destroy_singleton() {
+	ERR_FAIL_COND(g_singleton == NULL);
+	memdelete(g_singleton);
+	g_singleton = NULL;
+}
+
+uint64_t VoxelPerformance::get_monitor(Monitor id) const {
+	ERR_FAIL_INDEX_V(id, MONITOR_MAX, 0);
+	return g_values[id];
+}
+
+String VoxelPerformance::get_monitor_name(Monitor id) const {
+
+	ERR_FAIL_INDEX_V(id, MONITOR_MAX, String());
+
+	static const char *names[MONITOR_MAX] = {
+		"voxel/blocks_loaded",
+		"voxel/blocks_pending_load",
+		"voxel/blocks_pending_mesh",
+		"voxel/blocks_pending_main_thread",
+		"voxel/channel_memory",
+		"voxel/channel_memory_peak",
+		"voxel/mesh_vertices",
+		"voxel/mesh_memory",
+		"voxel/time_detect_required_blocks",
+		"voxel/time_send_load_requests",
+		"voxel/time_process_load_responses",
+		"voxel/time_send_update_requests",
+		"voxel/time_process_update_responses"
+	};
+
+	return names[id];
+}
+
+void VoxelPerformance::reset_peaks() {
+	set(CHANNEL_MEMORY_PEAK, g_values[CHANNEL_MEMORY]);
+}
+
+void VoxelPerformance::_bind_methods() {
+
+	ClassDB::bind_method(D_METHOD("get_monitor", "monitor"), &VoxelPerformance::get_monitor);
+	ClassDB::bind_method(D_METHOD("get_monitor_name", "monitor"), &VoxelPerformance::get_monitor_name);
+	ClassDB::bind_method(D_METHOD("reset_peaks"), &VoxelPerformance::reset_peaks);
+
+	BIND_ENUM_CONSTANT(BLOCKS_LOADED);
+	BIND_ENUM_CONSTANT(BLOCKS_PENDING_LOAD);
+	BIND_ENUM_CONSTANT(BLOCKS_PENDING_MESH);
+	BIND_ENUM_CONSTANT(BLOCKS_PENDING_MAIN_THREAD);
+	BIND_ENUM_CONSTANT(CHANNEL_MEMORY);
+	BIND_ENUM_CONSTANT(CHANNEL_MEMORY_PEAK);
+	BIND_ENUM_CONSTANT(MESH_VERTICES);
+	BIND_ENUM_CONSTANT(MESH_MEMORY);
+	BIND_ENUM_CONSTANT(TIME_DETECT_REQUIRED_BLOCKS);
+	BIND_ENUM_CONSTANT(TIME_SEND_LOAD_REQUESTS);
+	BIND_ENUM_CONSTANT(TIME_PROCESS_LOAD_RESPONSES);
+	BIND_ENUM_CONSTANT(TIME_SEND_UPDATE_REQUESTS);
+	BIND_ENUM_CONSTANT(TIME_PROCESS_UPDATE_RESPONSES);
+	BIND_ENUM_CONSTANT(MONITOR_MAX);
+}
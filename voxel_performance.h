@@ -0,0 +1,68 @@
+#ifndef VOXEL_PERFORMANCE_H
+#define VOXEL_PERFORMANCE_H
+
+#include <core/object.h>
+#include <core/safe_refcount.h>
+
+// Counters about voxel subsystems, for monitoring tools to poll.
+// They are maintained as things happen, using atomics so they can be updated from any thread,
+// and reading them doesn't compute nor allocate anything.
+// Godot's Performance singleton can't be given custom monitors at this version, so they are exposed by this singleton.
+class VoxelPerformance : public Object {
+	GDCLASS(VoxelPerformance, Object)
+public:
+	enum Monitor {
+		BLOCKS_LOADED = 0,
+		BLOCKS_PENDING_LOAD,
+		BLOCKS_PENDING_MESH,
+		BLOCKS_PENDING_MAIN_THREAD,
+		CHANNEL_MEMORY,
+		// Highest channel memory since startup or the last reset
+		CHANNEL_MEMORY_PEAK,
+		MESH_VERTICES,
+		// Estimated from mesh formats, without compression
+		MESH_MEMORY,
+		// Time spent in stages of the last terrain update, in microseconds
+		TIME_DETECT_REQUIRED_BLOCKS,
+		TIME_SEND_LOAD_REQUESTS,
+		TIME_PROCESS_LOAD_RESPONSES,
+		TIME_SEND_UPDATE_REQUESTS,
+		TIME_PROCESS_UPDATE_RESPONSES,
+		MONITOR_MAX
+	};
+
+	static void create_singleton();
+	static void destroy_singleton();
+	static VoxelPerformance *get_singleton() { return g_singleton; }
+
+	// These can be used before the singleton exists
+	static _FORCE_INLINE_ void increment(Monitor id, uint64_t amount) {
+		atomic_add(&g_values[id], amount);
+	}
+	static _FORCE_INLINE_ void decrement(Monitor id, uint64_t amount) {
+		atomic_sub(&g_values[id], amount);
+	}
+	static _FORCE_INLINE_ void set(Monitor id, uint64_t value) {
+		g_values[id] = value;
+	}
+	// Raises a high-water mark to the current value of another monitor
+	static _FORCE_INLINE_ void update_peak(Monitor peak_id, Monitor id) {
+		atomic_exchange_if_greater(&g_values[peak_id], g_values[id]);
+	}
+
+	uint64_t get_monitor(Monitor id) const;
+	String get_monitor_name(Monitor id) const;
+	// Sets high-water marks to current values
+	void reset_peaks();
+
+protected:
+	static void _bind_methods();
+
+private:
+	static VoxelPerformance *g_singleton;
+	static uint64_t g_values[MONITOR_MAX];
+};
+
+VARIANT_ENUM_CAST(VoxelPerformance::Monitor)
+
+#endif // VOXEL_PERFORMANCE_H
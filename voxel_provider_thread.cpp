@@ -5,6 +5,7 @@
 #include "voxel_provider.h"
 #include "voxel_map.h"
 #include "utility.h"
+#include "zprofiling.h"
 
 
 VoxelProviderThread::VoxelProviderThread(Ref<VoxelProvider> provider, int block_size_pow2) {
@@ -23,7 +24,7 @@ VoxelProviderThread::VoxelProviderThread(Ref<VoxelProvider> provider, int block_
 
 VoxelProviderThread::~VoxelProviderThread() {
 
-	_thread_exit = true;
+	request_exit();
 	_semaphore->post();
 	Thread::wait_to_finish(_thread);
 
@@ -44,7 +45,7 @@ void VoxelProviderThread::push(const InputData &input) {
 
 		_shared_input.blocks_to_emerge.append_array(input.blocks_to_emerge);
 		_shared_input.blocks_to_immerge.append_array(input.blocks_to_immerge);
-		_shared_input.priority_block_position = input.priority_block_position;
+		_shared_input.priority = input.priority;
 
 		should_run = !_shared_input.is_empty();
 	}
@@ -55,6 +56,16 @@ void VoxelProviderThread::push(const InputData &input) {
 	}
 }
 
+void VoxelProviderThread::request_exit() {
+	MutexLock lock(_input_mutex);
+	_thread_exit = true;
+}
+
+bool VoxelProviderThread::is_exit_requested() const {
+	MutexLock lock(_input_mutex);
+	return _thread_exit;
+}
+
 void VoxelProviderThread::pop(OutputData &out_data) {
 
 	MutexLock lock(_output_mutex);
@@ -71,7 +82,9 @@ void VoxelProviderThread::_thread_func(void *p_self) {
 
 void VoxelProviderThread::thread_func() {
 
-	while(!_thread_exit) {
+	VOXEL_PROFILE_THREAD_NAME("VoxelProviderThread");
+
+	while(!is_exit_requested()) {
 
 		uint32_t sync_interval = 100.0; // milliseconds
 		uint32_t sync_time = OS::get_singleton()->get_ticks_msec() + sync_interval;
@@ -81,7 +94,7 @@ void VoxelProviderThread::thread_func() {
 
 		thread_sync(emerge_index, stats);
 
-		while(!_input.is_empty() && !_thread_exit) {
+		while(!_input.is_empty() && !is_exit_requested()) {
 			//print_line(String("Thread runs: {0}").format(varray(_input.blocks_to_emerge.size())));
 
 			// TODO Block saving
@@ -92,6 +105,8 @@ void VoxelProviderThread::thread_func() {
 				Vector3i block_pos = _input.blocks_to_emerge[emerge_index];
 				++emerge_index;
 
+				VOXEL_PROFILE_SCOPE_ID("VoxelProviderThread emerge block", ZProfiler::get_block_correlation_id(block_pos));
+
 				if(emerge_index >= _input.blocks_to_emerge.size()) {
 					_input.blocks_to_emerge.clear();
 				}
@@ -106,6 +121,9 @@ void VoxelProviderThread::thread_func() {
 				_voxel_provider->emerge_block(buffer, block_origin_in_voxels);
 				uint64_t time_taken = OS::get_singleton()->get_ticks_usec() - time_before;
 
+				// Providers can write raw data, and writes only widen bounds, so the summary is found again once
+				buffer->compute_summary();
+
 				// Do some stats
 				if(stats.first) {
 					stats.first = false;
@@ -121,6 +139,8 @@ void VoxelProviderThread::thread_func() {
 				EmergeOutput eo;
 				eo.origin_in_voxels = block_origin_in_voxels;
 				eo.voxels = buffer;
+				eo.begin_time = time_before;
+				eo.end_time = time_before + time_taken;
 				_output.push_back(eo);
 			}
 
@@ -135,24 +155,25 @@ void VoxelProviderThread::thread_func() {
 			}
 		}
 
-		if(_thread_exit)
+		if(is_exit_requested())
 			break;
 
 		// Wait for future wake-up
 		_semaphore->wait();
 	}
 
+	VOXEL_PROFILE_THREAD_END();
+
 	print_line("Thread exits");
 }
 
-// Sorts distance to viewer
-// The closest block will be the first one in the array
-struct BlockPositionComparator {
-	Vector3i center;
-	inline bool operator()(const Vector3i &a, const Vector3i &b) const {
-		return a.distance_sq(center) < b.distance_sq(center);
-	}
-};
+static inline Vector3i get_block_position(const Vector3i &bpos) {
+	return bpos;
+}
+
+static inline bool is_block_urgent(const Vector3i &bpos) {
+	return false;
+}
 
 void VoxelProviderThread::thread_sync(int emerge_index, Stats stats) {
 
@@ -175,7 +196,7 @@ void VoxelProviderThread::thread_sync(int emerge_index, Stats stats) {
 
 		_input.blocks_to_emerge.append_array(_shared_input.blocks_to_emerge);
 		_input.blocks_to_immerge.append_array(_shared_input.blocks_to_immerge);
-		_input.priority_block_position = _shared_input.priority_block_position;
+		_input.priority = _shared_input.priority;
 
 		_shared_input.blocks_to_emerge.clear();
 		_shared_input.blocks_to_immerge.clear();
@@ -195,11 +216,8 @@ void VoxelProviderThread::thread_sync(int emerge_index, Stats stats) {
 	}
 
 	if (!_input.blocks_to_emerge.empty()) {
-		// Re-sort priority
-
-		SortArray<Vector3i, BlockPositionComparator> sorter;
-		sorter.compare.center = _input.priority_block_position;
-		sorter.sort(_input.blocks_to_emerge.ptrw(), _input.blocks_to_emerge.size());
+		// Re-sort priority, the most urgent block will be the first one in the array
+		_input.priority.sort(_input.blocks_to_emerge, get_block_position, is_block_urgent);
 	}
 }
 
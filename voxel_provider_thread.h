@@ -3,6 +3,7 @@
 
 #include "core/resource.h"
 #include "vector3i.h"
+#include "voxel_block_priority.h"
 
 class VoxelProvider;
 class VoxelBuffer;
@@ -19,7 +20,8 @@ public:
 	struct InputData {
 		Vector<ImmergeInput> blocks_to_immerge;
 		Vector<Vector3i> blocks_to_emerge;
-		Vector3i priority_block_position;
+		// Tells which blocks to emerge first
+		VoxelBlockPriority priority;
 
 		inline bool is_empty() {
 			return blocks_to_emerge.empty() && blocks_to_immerge.empty();
@@ -29,6 +31,9 @@ public:
 	struct EmergeOutput {
 		Ref<VoxelBuffer> voxels;
 		Vector3i origin_in_voxels;
+		// When the provider started and finished generating the block, in microseconds
+		uint64_t begin_time;
+		uint64_t end_time;
 	};
 
 	struct Stats {
@@ -57,6 +62,10 @@ private:
 	void thread_func();
 	void thread_sync(int emerge_index, Stats stats);
 
+	// The flag is shared with the thread, so it is only accessed under lock
+	void request_exit();
+	bool is_exit_requested() const;
+
 private:
 	InputData _shared_input;
 	Mutex *_input_mutex;
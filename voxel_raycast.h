@@ -1,4 +1,8 @@
+#ifndef VOXEL_RAYCAST_H
+#define VOXEL_RAYCAST_H
+
 #include "vector3i.h"
+#include <core/math/math_funcs.h>
 #include <core/math/vector3.h>
 
 // TODO that could be a template function
@@ -14,3 +18,141 @@ bool voxel_raycast(
 		real_t max_distance,
 		Vector3i &out_hit_pos,
 		Vector3i &out_prev_pos);
+
+// Walks grid cells crossed by a ray, one at a time.
+// Crossings are computed from the ray origin, so it can start from any cell the ray goes through.
+struct VoxelRaycastDDA {
+	Vector3i pos;
+	Vector3i step;
+	// Distance along the ray between two crossings on each axis
+	Vector3 tdelta;
+	// Distance along the ray at which the next crossing happens on each axis
+	Vector3 tcross;
+
+	void init(const Vector3 &ray_origin, const Vector3 &ray_direction, Vector3i start_cell, real_t cell_size) {
+
+		const real_t infinite = 9999999;
+		pos = start_cell;
+
+		for (unsigned int i = 0; i < 3; ++i) {
+			const real_t d = ray_direction[i];
+			if (d == 0) {
+				step[i] = 0;
+				tdelta[i] = infinite;
+				tcross[i] = infinite;
+			} else {
+				step[i] = d > 0 ? 1 : -1;
+				tdelta[i] = cell_size / Math::abs(d);
+				const real_t boundary = (start_cell[i] + (d > 0 ? 1 : 0)) * cell_size;
+				tcross[i] = (boundary - ray_origin[i]) / d;
+			}
+		}
+	}
+
+	// Distance along the ray at which it leaves the current cell
+	_FORCE_INLINE_ real_t get_exit_distance() const {
+		return MIN(tcross.x, MIN(tcross.y, tcross.z));
+	}
+
+	// Moves to the next cell. Returns the distance at which it was entered, and through which axis.
+	_FORCE_INLINE_ real_t advance(int &out_axis) {
+		out_axis = tcross.x < tcross.y ? (tcross.x < tcross.z ? Vector3::AXIS_X : Vector3::AXIS_Z) : (tcross.y < tcross.z ? Vector3::AXIS_Y : Vector3::AXIS_Z);
+		const real_t t = tcross[out_axis];
+		pos[out_axis] += step[out_axis];
+		tcross[out_axis] += tdelta[out_axis];
+		return t;
+	}
+};
+
+// Same as voxel_raycast, but traverses blocks of voxels first, and only visits voxels of blocks that may contain a hit.
+// Long rays through air and unloaded areas then take a few steps instead of one per voxel.
+// The predicate must provide:
+// - bool enter_block(Vector3i block_pos): returns false if no voxel of the block can be hit, so it gets skipped.
+// - bool operator()(Vector3i voxel_pos): tests a voxel of the last entered block.
+// Like voxel_raycast, the voxel containing the origin is not tested.
+template <typename Predicate_F>
+bool voxel_raycast_hierarchical(
+		Vector3 ray_origin,
+		Vector3 ray_direction,
+		unsigned int block_size_pow2,
+		Predicate_F &predicate,
+		real_t max_distance,
+		Vector3i &out_hit_pos,
+		Vector3i &out_prev_pos) {
+
+	ERR_FAIL_COND_V(ray_direction.is_normalized() == false, false); // Must be normalized
+
+	const int block_size = 1 << block_size_pow2;
+
+	const Vector3i origin_voxel(ray_origin);
+
+	VoxelRaycastDDA blocks;
+	blocks.init(ray_origin, ray_direction, Vector3i(
+			origin_voxel.x >> block_size_pow2,
+			origin_voxel.y >> block_size_pow2,
+			origin_voxel.z >> block_size_pow2), block_size);
+
+	real_t t_enter = 0;
+	int enter_axis = -1;
+
+	while (true) {
+
+		if (predicate.enter_block(blocks.pos)) {
+
+			// Descend into voxels of the block
+			const Vector3i block_min = blocks.pos * block_size;
+			const Vector3i block_max = block_min + Vector3i(block_size - 1);
+
+			Vector3i voxel;
+			if (enter_axis == -1) {
+				voxel = origin_voxel;
+			} else {
+				voxel = Vector3i(ray_origin + ray_direction * t_enter);
+				// Precision errors could put the entry point outside the block
+				voxel.clamp_to(block_min, block_max + Vector3i(1));
+				voxel[enter_axis] = blocks.step[enter_axis] > 0 ? block_min[enter_axis] : block_max[enter_axis];
+
+				Vector3i prev = voxel;
+				prev[enter_axis] -= blocks.step[enter_axis];
+
+				if (predicate(voxel)) {
+					out_hit_pos = voxel;
+					out_prev_pos = prev;
+					return true;
+				}
+			}
+
+			VoxelRaycastDDA voxels;
+			voxels.init(ray_origin, ray_direction, voxel, 1);
+
+			while (true) {
+				const Vector3i prev = voxels.pos;
+				int axis;
+				const real_t t = voxels.advance(axis);
+
+				if (t > max_distance)
+					return false;
+
+				const Vector3i &pos = voxels.pos;
+				if (pos[axis] < block_min[axis] || pos[axis] > block_max[axis]) {
+					// Left the block
+					break;
+				}
+
+				if (predicate(pos)) {
+					out_hit_pos = pos;
+					out_prev_pos = prev;
+					return true;
+				}
+			}
+		}
+
+		t_enter = blocks.advance(enter_axis);
+		if (t_enter > max_distance)
+			return false;
+	}
+
+	return false;
+}
+
+#endif // VOXEL_RAYCAST_H
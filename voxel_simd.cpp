@@ -0,0 +1,313 @@
+#include "voxel_simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+// SSE2 is part of x86-64, but not guaranteed on 32-bit builds
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOXEL_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+// AVX2 functions are compiled for that target alone, so the rest of the build doesn't need to require it
+#if defined(VOXEL_SIMD_SSE2) && (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+#define VOXEL_SIMD_AVX2
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define VOXEL_TARGET_AVX2
+#else
+#define VOXEL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#endif
+
+// Scalar
+
+static bool is_uniform_scalar(const uint8_t *data, uint32_t size) {
+	if (size == 0)
+		return true;
+	const uint8_t v = data[0];
+	for (uint32_t i = 1; i < size; ++i) {
+		if (data[i] != v)
+			return false;
+	}
+	return true;
+}
+
+static void get_min_max_scalar(const uint8_t *data, uint32_t size, uint8_t &out_min, uint8_t &out_max) {
+	uint8_t min = data[0];
+	uint8_t max = data[0];
+	for (uint32_t i = 1; i < size; ++i) {
+		const uint8_t v = data[i];
+		if (v < min)
+			min = v;
+		if (v > max)
+			max = v;
+	}
+	out_min = min;
+	out_max = max;
+}
+
+// Used by vector versions for the last values that don't fill a register
+static void get_min_max_tail(const uint8_t *data, uint32_t begin, uint32_t end, uint8_t &min, uint8_t &max) {
+	for (uint32_t i = begin; i < end; ++i) {
+		const uint8_t v = data[i];
+		if (v < min)
+			min = v;
+		if (v > max)
+			max = v;
+	}
+}
+
+static bool is_uniform_tail(const uint8_t *data, uint32_t begin, uint32_t end, uint8_t v) {
+	for (uint32_t i = begin; i < end; ++i) {
+		if (data[i] != v)
+			return false;
+	}
+	return true;
+}
+
+// SSE2
+
+#ifdef VOXEL_SIMD_SSE2
+
+static bool is_uniform_sse2(const uint8_t *data, uint32_t size) {
+	if (size == 0)
+		return true;
+
+	const __m128i v = _mm_set1_epi8(data[0]);
+	uint32_t i = 0;
+
+	// Several registers per iteration, so there are less branches
+	for (; i + 64 <= size; i += 64) {
+		const __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), v);
+		const __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + 16)), v);
+		const __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + 32)), v);
+		const __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + 48)), v);
+		const __m128i all = _mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d));
+		if (_mm_movemask_epi8(all) != 0xffff)
+			return false;
+	}
+
+	for (; i + 16 <= size; i += 16) {
+		const __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), v);
+		if (_mm_movemask_epi8(a) != 0xffff)
+			return false;
+	}
+
+	return is_uniform_tail(data, i, size, data[0]);
+}
+
+static void get_min_max_sse2(const uint8_t *data, uint32_t size, uint8_t &out_min, uint8_t &out_max) {
+
+	uint8_t min = data[0];
+	uint8_t max = data[0];
+	uint32_t i = 0;
+
+	if (size >= 16) {
+		__m128i vmin = _mm_loadu_si128((const __m128i *)data);
+		__m128i vmax = vmin;
+
+		for (i = 16; i + 16 <= size; i += 16) {
+			const __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+			vmin = _mm_min_epu8(vmin, a);
+			vmax = _mm_max_epu8(vmax, a);
+		}
+
+		uint8_t mins[16];
+		uint8_t maxs[16];
+		_mm_storeu_si128((__m128i *)mins, vmin);
+		_mm_storeu_si128((__m128i *)maxs, vmax);
+		for (int j = 0; j < 16; ++j) {
+			if (mins[j] < min)
+				min = mins[j];
+			if (maxs[j] > max)
+				max = maxs[j];
+		}
+	}
+
+	get_min_max_tail(data, i, size, min, max);
+	out_min = min;
+	out_max = max;
+}
+
+#endif // VOXEL_SIMD_SSE2
+
+// AVX2
+
+#ifdef VOXEL_SIMD_AVX2
+
+VOXEL_TARGET_AVX2 static bool is_uniform_avx2(const uint8_t *data, uint32_t size) {
+	if (size == 0)
+		return true;
+
+	const __m256i v = _mm256_set1_epi8(data[0]);
+	uint32_t i = 0;
+
+	for (; i + 128 <= size; i += 128) {
+		const __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), v);
+		const __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i + 32)), v);
+		const __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i + 64)), v);
+		const __m256i d = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i + 96)), v);
+		const __m256i all = _mm256_and_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, d));
+		if (_mm256_movemask_epi8(all) != -1)
+			return false;
+	}
+
+	for (; i + 32 <= size; i += 32) {
+		const __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), v);
+		if (_mm256_movemask_epi8(a) != -1)
+			return false;
+	}
+
+	return is_uniform_tail(data, i, size, data[0]);
+}
+
+VOXEL_TARGET_AVX2 static void get_min_max_avx2(const uint8_t *data, uint32_t size, uint8_t &out_min, uint8_t &out_max) {
+
+	uint8_t min = data[0];
+	uint8_t max = data[0];
+	uint32_t i = 0;
+
+	if (size >= 32) {
+		__m256i vmin = _mm256_loadu_si256((const __m256i *)data);
+		__m256i vmax = vmin;
+
+		for (i = 32; i + 32 <= size; i += 32) {
+			const __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+			vmin = _mm256_min_epu8(vmin, a);
+			vmax = _mm256_max_epu8(vmax, a);
+		}
+
+		uint8_t mins[32];
+		uint8_t maxs[32];
+		_mm256_storeu_si256((__m256i *)mins, vmin);
+		_mm256_storeu_si256((__m256i *)maxs, vmax);
+		for (int j = 0; j < 32; ++j) {
+			if (mins[j] < min)
+				min = mins[j];
+			if (maxs[j] > max)
+				max = maxs[j];
+		}
+	}
+
+	get_min_max_tail(data, i, size, min, max);
+	out_min = min;
+	out_max = max;
+}
+
+static bool is_avx2_supported_by_cpu() {
+#if defined(_MSC_VER) && !defined(__clang__)
+	int regs[4];
+	__cpuid(regs, 1);
+	// The OS must also save YMM registers
+	const bool osxsave = (regs[2] & (1 << 27)) != 0;
+	const bool avx = (regs[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuid(regs, 0);
+	if (regs[0] < 7)
+		return false;
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // VOXEL_SIMD_AVX2
+
+// Dispatch
+
+VoxelSimd::Level VoxelSimd::g_level = VoxelSimd::LEVEL_SCALAR;
+VoxelSimd::IsUniformFunc VoxelSimd::g_is_uniform = is_uniform_scalar;
+VoxelSimd::MinMaxFunc VoxelSimd::g_get_min_max = get_min_max_scalar;
+
+void VoxelSimd::init() {
+	if (set_level(LEVEL_AVX2))
+		return;
+	if (set_level(LEVEL_SSE2))
+		return;
+	set_level(LEVEL_SCALAR);
+}
+
+bool VoxelSimd::is_level_supported(Level level) {
+	switch (level) {
+		case LEVEL_SCALAR:
+			return true;
+#ifdef VOXEL_SIMD_SSE2
+		case LEVEL_SSE2:
+			return true;
+#endif
+#ifdef VOXEL_SIMD_AVX2
+		case LEVEL_AVX2:
+			return is_avx2_supported_by_cpu();
+#endif
+		default:
+			return false;
+	}
+}
+
+const char *VoxelSimd::get_level_name(Level level) {
+	switch (level) {
+		case LEVEL_SCALAR:
+			return "scalar";
+		case LEVEL_SSE2:
+			return "sse2";
+		case LEVEL_AVX2:
+			return "avx2";
+		default:
+			return "unknown";
+	}
+}
+
+bool VoxelSimd::set_level(Level level) {
+
+	if (!is_level_supported(level))
+		return false;
+
+	switch (level) {
+#ifdef VOXEL_SIMD_SSE2
+		case LEVEL_SSE2:
+			g_is_uniform = is_uniform_sse2;
+			g_get_min_max = get_min_max_sse2;
+			break;
+#endif
+#ifdef VOXEL_SIMD_AVX2
+		case LEVEL_AVX2:
+			g_is_uniform = is_uniform_avx2;
+			g_get_min_max = get_min_max_avx2;
+			break;
+#endif
+		default:
+			g_is_uniform = is_uniform_scalar;
+			g_get_min_max = get_min_max_scalar;
+			break;
+	}
+
+	g_level = level;
+	return true;
+}
+
+void VoxelSimd::add_histogram(const uint8_t *data, uint32_t size, uint32_t counts[256]) {
+
+	// Consecutive voxels often have the same value, which would make every increment wait for the previous one.
+	// Spreading them over separate tables lets them run in parallel.
+	uint32_t tables[4][256] = { { 0 } };
+
+	uint32_t i = 0;
+	for (; i + 4 <= size; i += 4) {
+		++tables[0][data[i]];
+		++tables[1][data[i + 1]];
+		++tables[2][data[i + 2]];
+		++tables[3][data[i + 3]];
+	}
+	for (; i < size; ++i) {
+		++tables[0][data[i]];
+	}
+
+	for (int v = 0; v < 256; ++v) {
+		counts[v] += tables[0][v] + tables[1][v] + tables[2][v] + tables[3][v];
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef VOXEL_SIMD_H
+#define VOXEL_SIMD_H
+
+#include <core/typedefs.h>
+
+// Bulk operations on arrays of voxels.
+// Vectorized versions are chosen at runtime depending on what the CPU supports, with a scalar fallback.
+class VoxelSimd {
+public:
+	enum Level {
+		LEVEL_SCALAR = 0,
+		LEVEL_SSE2,
+		LEVEL_AVX2,
+		LEVEL_COUNT
+	};
+
+	// Picks the best level the CPU supports. Must be called before threads use the functions below,
+	// which use the scalar versions until then.
+	static void init();
+
+	static bool is_level_supported(Level level);
+	static const char *get_level_name(Level level);
+	static Level get_level() { return g_level; }
+	// Forces a level, to compare them. Same restrictions as init().
+	// Returns false if the CPU doesn't support it.
+	static bool set_level(Level level);
+
+	// Tells if all values are the same
+	static _FORCE_INLINE_ bool is_uniform(const uint8_t *data, uint32_t size) {
+		return g_is_uniform(data, size);
+	}
+
+	// `size` must not be zero
+	static _FORCE_INLINE_ void get_min_max(const uint8_t *data, uint32_t size, uint8_t &out_min, uint8_t &out_max) {
+		g_get_min_max(data, size, out_min, out_max);
+	}
+
+	// Adds how many times each value appears to `counts`.
+	// Bins are too many for vector registers, so there is only a scalar version, which spreads counts over several tables.
+	static void add_histogram(const uint8_t *data, uint32_t size, uint32_t counts[256]);
+
+private:
+	typedef bool (*IsUniformFunc)(const uint8_t *, uint32_t);
+	typedef void (*MinMaxFunc)(const uint8_t *, uint32_t, uint8_t &, uint8_t &);
+
+	static Level g_level;
+	static IsUniformFunc g_is_uniform;
+	static MinMaxFunc g_get_min_max;
+};
+
+#endif // VOXEL_SIMD_H
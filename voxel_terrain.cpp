@@ -5,11 +5,17 @@
 #include "voxel_raycast.h"
 #include "voxel_provider_test.h"
 #include "utility.h"
+#include "voxel_performance.h"
+#include "cube_tables.h"
+#include "voxel_job_pool.h"
 
 #include <core/os/os.h>
+#include <scene/3d/camera.h>
 #include <scene/3d/mesh_instance.h>
+#include <scene/main/viewport.h>
 #include <core/engine.h>
 
+const int VoxelTerrain::DEFAULT_VIEWER_ID;
 
 VoxelTerrain::VoxelTerrain()
 	: Spatial(), _generate_collisions(true) {
@@ -17,13 +23,39 @@ VoxelTerrain::VoxelTerrain()
 	_map = Ref<VoxelMap>(memnew(VoxelMap));
 
 	_view_distance_blocks = 8;
-	_last_view_distance_blocks = 0;
+	_unload_margin_blocks = 1;
+	_eviction_memory_budget = 16 * 1024 * 1024;
+	_eviction_queue_memory = 0;
+	_view_shape = VIEW_SHAPE_BOX;
+	_view_distance_up_blocks = -1;
+	_view_distance_down_blocks = -1;
+	_all_view_dirty = false;
+	_edit_depth = 0;
+	_low_latency_edit_distance_blocks = 0;
+
+	_reported_pending_loads = 0;
+	_reported_pending_meshes = 0;
+	_reported_pending_main_thread_blocks = 0;
+	_next_update_sequence = 0;
+
+	// The viewer driven by the node path is always present
+	_viewers[DEFAULT_VIEWER_ID] = Viewer();
+	_next_viewer_id = DEFAULT_VIEWER_ID + 1;
+
+	_collision_distance_blocks = 2;
+
+	_prefetch_lookahead_time = 0.5;
+	_prefetch_direction_weight = 0;
 
 	_provider_thread = NULL;
 	_block_updater = NULL;
 
 	_generate_collisions = false;
+	_generate_meshes = true;
 	_run_in_editor = false;
+
+	_cave_culling = false;
+	_culling_frame = 0;
 }
 
 VoxelTerrain::~VoxelTerrain() {
@@ -34,6 +66,37 @@ VoxelTerrain::~VoxelTerrain() {
 	if(_block_updater) {
 		memdelete(_block_updater);
 	}
+
+	// Take back what this terrain contributed to global counters
+	report_pending_count(VoxelPerformance::BLOCKS_PENDING_LOAD, 0, _reported_pending_loads);
+	report_pending_count(VoxelPerformance::BLOCKS_PENDING_MESH, 0, _reported_pending_meshes);
+	report_pending_count(VoxelPerformance::BLOCKS_PENDING_MAIN_THREAD, 0, _reported_pending_main_thread_blocks);
+}
+
+// Global counters add up all terrains, so each terrain adds the difference with what it reported before
+void VoxelTerrain::report_pending_count(int monitor, int count, int &reported_count) {
+	VoxelPerformance::Monitor id = (VoxelPerformance::Monitor)monitor;
+	if (count > reported_count) {
+		VoxelPerformance::increment(id, count - reported_count);
+	} else if (count < reported_count) {
+		VoxelPerformance::decrement(id, reported_count - count);
+	}
+	reported_count = count;
+}
+
+void VoxelTerrain::update_performance_monitors() {
+
+	_stats.remaining_main_thread_blocks = _blocks_pending_main_thread_update.size();
+
+	report_pending_count(VoxelPerformance::BLOCKS_PENDING_LOAD, _blocks_pending_load.size() + _stats.provider.remaining_blocks, _reported_pending_loads);
+	report_pending_count(VoxelPerformance::BLOCKS_PENDING_MESH, _blocks_pending_update.size() + _stats.updater.remaining_blocks, _reported_pending_meshes);
+	report_pending_count(VoxelPerformance::BLOCKS_PENDING_MAIN_THREAD, _stats.remaining_main_thread_blocks, _reported_pending_main_thread_blocks);
+
+	VoxelPerformance::set(VoxelPerformance::TIME_DETECT_REQUIRED_BLOCKS, _stats.time_detect_required_blocks);
+	VoxelPerformance::set(VoxelPerformance::TIME_SEND_LOAD_REQUESTS, _stats.time_send_load_requests);
+	VoxelPerformance::set(VoxelPerformance::TIME_PROCESS_LOAD_RESPONSES, _stats.time_process_load_responses);
+	VoxelPerformance::set(VoxelPerformance::TIME_SEND_UPDATE_REQUESTS, _stats.time_send_update_requests);
+	VoxelPerformance::set(VoxelPerformance::TIME_PROCESS_UPDATE_RESPONSES, _stats.time_process_update_responses);
 }
 
 // TODO See if there is a way to specify materials in voxels directly?
@@ -79,6 +142,7 @@ void VoxelTerrain::set_provider(Ref<VoxelProvider> provider) {
 
 		_provider = provider;
 		_provider_thread = memnew(VoxelProviderThread(_provider, _map->get_block_size_pow2()));
+		resend_requests(BLOCK_LOAD);
 //		Ref<VoxelProviderTest> test;
 //		test.instance();
 //		_provider_thread = memnew(VoxelProviderThread(test, _map->get_block_size_pow2()));
@@ -111,20 +175,77 @@ void VoxelTerrain::set_voxel_library(Ref<VoxelLibrary> library) {
 		if(_block_updater) {
 			memdelete(_block_updater);
 			_block_updater = NULL;
+			resend_requests(BLOCK_UPDATE_SENT);
 		}
 
+		update_block_updater();
+
+		// Voxel appearance might completely change
+		make_all_view_dirty_deferred();
+	}
+}
+
+void VoxelTerrain::update_block_updater() {
+
+	bool needed = _library.is_valid() && (_generate_meshes || _generate_collisions);
+
+	if(needed && _block_updater == NULL) {
 		// TODO Thread-safe way to change those parameters
 		VoxelMeshUpdater::MeshingParams params;
-
 		_block_updater = memnew(VoxelMeshUpdater(_library, params));
 
-		// Voxel appearance might completely change
+	} else if(!needed && _block_updater) {
+		memdelete(_block_updater);
+		_block_updater = NULL;
+		// Blocks that were being processed will never come back
+		resend_requests(BLOCK_UPDATE_SENT);
 		make_all_view_dirty_deferred();
 	}
 }
 
+// When a thread is destroyed, the requests it was given are lost.
+// Blocks waiting for them would stay in that state forever, so they are scheduled again.
+void VoxelTerrain::resend_requests(BlockDirtyState sent_state) {
+
+	const Vector3i *key = NULL;
+	while (key = _dirty_blocks.next(key)) {
+		BlockDirtyState &state = _dirty_blocks.get(*key);
+		if (state != sent_state)
+			continue;
+
+		if (state == BLOCK_LOAD) {
+			_blocks_pending_load.push_back(*key);
+
+		} else if (state == BLOCK_UPDATE_SENT) {
+			state = BLOCK_UPDATE_NOT_SENT;
+			_blocks_pending_update.push_back(*key);
+		}
+	}
+}
+
 void VoxelTerrain::set_generate_collisions(bool enabled) {
 	_generate_collisions = enabled;
+	update_block_updater();
+}
+
+struct ClearMeshAction {
+	void operator()(VoxelBlock *block) {
+		block->set_mesh(Ref<Mesh>(), Ref<World>());
+	}
+};
+
+void VoxelTerrain::set_generate_meshes(bool enabled) {
+	if(enabled == _generate_meshes) {
+		return;
+	}
+	_generate_meshes = enabled;
+	update_block_updater();
+
+	if(_generate_meshes) {
+		make_all_view_dirty_deferred();
+	} else {
+		_map->for_all_blocks(ClearMeshAction());
+	}
 }
 
 int VoxelTerrain::get_view_distance() const {
@@ -141,6 +262,81 @@ void VoxelTerrain::set_view_distance(int distance_in_voxels) {
 	}
 }
 
+int VoxelTerrain::get_unload_margin() const {
+	return _unload_margin_blocks * _map->get_block_size();
+}
+
+void VoxelTerrain::set_unload_margin(int distance_in_voxels) {
+	ERR_FAIL_COND(distance_in_voxels < 0);
+	_unload_margin_blocks = distance_in_voxels / _map->get_block_size();
+	// Blocks entering or leaving the margin will be handled in _process
+}
+
+void VoxelTerrain::set_eviction_memory_budget(int bytes) {
+	ERR_FAIL_COND(bytes < 0);
+	_eviction_memory_budget = bytes;
+	trim_eviction_queue(_eviction_memory_budget);
+}
+
+void VoxelTerrain::set_view_shape(ViewShape shape) {
+	ERR_FAIL_COND(shape < 0 || shape >= (int)VoxelViewRegion::SHAPE_COUNT);
+	_view_shape = shape;
+	// Blocks entering or leaving the new shape will be handled in _process
+}
+
+int VoxelTerrain::get_view_distance_up() const {
+	if (_view_distance_up_blocks < 0)
+		return -1;
+	return _view_distance_up_blocks * _map->get_block_size();
+}
+
+void VoxelTerrain::set_view_distance_up(int distance_in_voxels) {
+	_view_distance_up_blocks = distance_in_voxels < 0 ? -1 : distance_in_voxels / _map->get_block_size();
+}
+
+int VoxelTerrain::get_view_distance_down() const {
+	if (_view_distance_down_blocks < 0)
+		return -1;
+	return _view_distance_down_blocks * _map->get_block_size();
+}
+
+void VoxelTerrain::set_view_distance_down(int distance_in_voxels) {
+	_view_distance_down_blocks = distance_in_voxels < 0 ? -1 : distance_in_voxels / _map->get_block_size();
+}
+
+int VoxelTerrain::get_collision_distance() const {
+	return _collision_distance_blocks * _map->get_block_size();
+}
+
+void VoxelTerrain::set_collision_distance(int distance_in_voxels) {
+	ERR_FAIL_COND(distance_in_voxels < 0)
+	_collision_distance_blocks = distance_in_voxels / _map->get_block_size();
+	// Blocks entering or leaving the collision area will be handled in _process
+}
+
+void VoxelTerrain::set_cave_culling(bool enabled) {
+	if (enabled == _cave_culling) {
+		return;
+	}
+	_cave_culling = enabled;
+	if (_cave_culling) {
+		// Side connections are only found while culling is enabled, so blocks meshed before need an update.
+		// Blocks get culled in _process meanwhile, without hiding anything until their connections are known.
+		make_all_view_dirty_deferred();
+	} else {
+		reset_block_visibility();
+	}
+}
+
+void VoxelTerrain::set_prefetch_lookahead_time(float seconds) {
+	ERR_FAIL_COND(seconds < 0);
+	_prefetch_lookahead_time = seconds;
+}
+
+void VoxelTerrain::set_prefetch_direction_weight(float weight) {
+	_prefetch_direction_weight = CLAMP(weight, 0, 0.99);
+}
+
 void VoxelTerrain::set_viewer_path(NodePath path) {
 	_viewer_path = path;
 }
@@ -158,6 +354,270 @@ Spatial *VoxelTerrain::get_viewer(NodePath path) const {
 	return Object::cast_to<Spatial>(node);
 }
 
+int VoxelTerrain::add_viewer(Vector3 position, int view_distance_in_voxels) {
+	ERR_FAIL_COND_V(view_distance_in_voxels < 0, -1);
+
+	int id = _next_viewer_id++;
+
+	Viewer viewer;
+	viewer.position = position;
+	viewer.prev_position = position;
+	viewer.view_distance_blocks = view_distance_in_voxels / _map->get_block_size();
+	_viewers[id] = viewer;
+
+	// Blocks around it will be requested in _process
+	return id;
+}
+
+void VoxelTerrain::remove_viewer(int id) {
+	ERR_FAIL_COND(id == DEFAULT_VIEWER_ID);
+	Viewer *viewer = _viewers.getptr(id);
+	ERR_FAIL_COND(viewer == NULL);
+
+	// Release blocks it was referencing
+	set_viewer_region(*viewer, VoxelViewRegion(), VoxelViewRegion());
+	set_viewer_collision_box(*viewer, Rect3i());
+
+	_viewers.erase(id);
+}
+
+void VoxelTerrain::set_viewer_position(int id, Vector3 position) {
+	ERR_FAIL_COND(id == DEFAULT_VIEWER_ID);
+	Viewer *viewer = _viewers.getptr(id);
+	ERR_FAIL_COND(viewer == NULL);
+	viewer->position = position;
+}
+
+Vector3 VoxelTerrain::get_viewer_position(int id) const {
+	const Viewer *viewer = _viewers.getptr(id);
+	ERR_FAIL_COND_V(viewer == NULL, Vector3());
+	return viewer->position;
+}
+
+void VoxelTerrain::set_viewer_view_distance(int id, int distance_in_voxels) {
+	ERR_FAIL_COND(id == DEFAULT_VIEWER_ID);
+	ERR_FAIL_COND(distance_in_voxels < 0);
+	Viewer *viewer = _viewers.getptr(id);
+	ERR_FAIL_COND(viewer == NULL);
+	viewer->view_distance_blocks = distance_in_voxels / _map->get_block_size();
+}
+
+int VoxelTerrain::get_viewer_view_distance(int id) const {
+	const Viewer *viewer = _viewers.getptr(id);
+	ERR_FAIL_COND_V(viewer == NULL, 0);
+	return viewer->view_distance_blocks * _map->get_block_size();
+}
+
+void VoxelTerrain::update_viewer_motion(Viewer &viewer, float delta) {
+
+	Vector3 motion = viewer.position - viewer.prev_position;
+	viewer.prev_position = viewer.position;
+
+	if (delta <= 0)
+		return;
+
+	if (motion.length() > viewer.view_distance_blocks * _map->get_block_size()) {
+		// Teleported, there is nothing to predict
+		viewer.velocity = Vector3();
+		return;
+	}
+
+	// Smooth it so small jitters don't re-sort queues each frame
+	const float smoothing_time = 0.25;
+	viewer.velocity = viewer.velocity.linear_interpolate(motion / delta, MIN(delta / smoothing_time, 1.0));
+}
+
+Vector3i VoxelTerrain::get_predicted_block_position(const Viewer &viewer) const {
+
+	Vector3 offset = viewer.velocity * _prefetch_lookahead_time;
+
+	// Don't prioritize further than what can be loaded
+	float max_distance = viewer.view_distance_blocks * _map->get_block_size();
+	float d = offset.length();
+	if (d > max_distance) {
+		offset *= max_distance / d;
+	}
+
+	return _map->voxel_to_block(viewer.position + offset);
+}
+
+void VoxelTerrain::ref_block(Vector3i bpos) {
+	int *refcount = _block_refcounts.getptr(bpos);
+	if(refcount) {
+		++(*refcount);
+	} else {
+		_block_refcounts[bpos] = 1;
+		// Load the block, unless it was retained
+		if(!_map->has_block(bpos)) {
+			make_block_dirty(bpos);
+		}
+	}
+}
+
+void VoxelTerrain::unref_block(Vector3i bpos) {
+	int *refcount = _block_refcounts.getptr(bpos);
+	ERR_FAIL_COND(refcount == NULL);
+	--(*refcount);
+	if(*refcount == 0) {
+		_block_refcounts.erase(bpos);
+		// The block stays loaded while it is retained, but if it's not loaded yet, it's not needed anymore
+		VoxelTerrain::BlockDirtyState *state = _dirty_blocks.getptr(bpos);
+		if(state && *state == BLOCK_LOAD) {
+			_dirty_blocks.erase(bpos);
+		}
+	}
+}
+
+void VoxelTerrain::retain_block(Vector3i bpos) {
+	int *refcount = _block_retain_refcounts.getptr(bpos);
+	if(refcount) {
+		++(*refcount);
+	} else {
+		_block_retain_refcounts[bpos] = 1;
+		revive_block(bpos);
+	}
+}
+
+void VoxelTerrain::release_block(Vector3i bpos) {
+	int *refcount = _block_retain_refcounts.getptr(bpos);
+	ERR_FAIL_COND(refcount == NULL);
+	--(*refcount);
+	if(*refcount == 0) {
+		_block_retain_refcounts.erase(bpos);
+		evict_block(bpos);
+	}
+}
+
+VoxelViewRegion VoxelTerrain::get_view_region(Vector3i center, int view_distance_blocks, int margin_blocks) const {
+	if (view_distance_blocks <= 0) {
+		// Inactive viewer
+		return VoxelViewRegion();
+	}
+	int up = _view_distance_up_blocks < 0 ? view_distance_blocks : _view_distance_up_blocks;
+	int down = _view_distance_down_blocks < 0 ? view_distance_blocks : _view_distance_down_blocks;
+	return VoxelViewRegion((VoxelViewRegion::Shape)_view_shape, center,
+			view_distance_blocks + margin_blocks, up + margin_blocks, down + margin_blocks);
+}
+
+void VoxelTerrain::set_viewer_region(Viewer &viewer, const VoxelViewRegion &new_region, const VoxelViewRegion &new_retain_region) {
+
+	// Only visit blocks that enter or leave regions.
+	// If the viewer teleported far away, the regions don't overlap and each difference is the whole region.
+	// Blocks are retained before they get loaded, and released after they stop being loaded.
+	Vector<Rect3i> boxes;
+
+	const VoxelViewRegion prev_retain_region = viewer.retain_region;
+	viewer.retain_region = new_retain_region;
+
+	if(prev_retain_region != new_retain_region) {
+		VoxelViewRegion::difference(new_retain_region, prev_retain_region, boxes);
+		for_each_block(boxes, &VoxelTerrain::retain_block);
+	}
+
+	const VoxelViewRegion prev_region = viewer.region;
+	viewer.region = new_region;
+
+	if(prev_region != new_region) {
+		boxes.clear();
+		VoxelViewRegion::difference(prev_region, new_region, boxes);
+		for_each_block(boxes, &VoxelTerrain::unref_block);
+
+		boxes.clear();
+		VoxelViewRegion::difference(new_region, prev_region, boxes);
+		for_each_block(boxes, &VoxelTerrain::ref_block);
+	}
+
+	if(prev_retain_region != new_retain_region) {
+		boxes.clear();
+		VoxelViewRegion::difference(prev_retain_region, new_retain_region, boxes);
+		for_each_block(boxes, &VoxelTerrain::release_block);
+	}
+}
+
+void VoxelTerrain::for_each_block(const Vector<Rect3i> &boxes, void (VoxelTerrain::*action)(Vector3i)) {
+	for(int i = 0; i < boxes.size(); ++i) {
+		const Rect3i &box = boxes[i];
+		Vector3i max = box.pos + box.size;
+		Vector3i pos;
+		for(pos.z = box.pos.z; pos.z < max.z; ++pos.z) {
+			for(pos.y = box.pos.y; pos.y < max.y; ++pos.y) {
+				for(pos.x = box.pos.x; pos.x < max.x; ++pos.x) {
+					(this->*action)(pos);
+				}
+			}
+		}
+	}
+}
+
+void VoxelTerrain::set_viewer_collision_box(Viewer &viewer, Rect3i new_box) {
+
+	Rect3i prev_box = viewer.collision_box;
+	if(prev_box == new_box) {
+		return;
+	}
+
+	// Assigned first so is_in_collision_area() takes it into account
+	viewer.collision_box = new_box;
+
+	Rect3i slabs[Rect3i::MAX_DIFFERENCE_BOXES];
+
+	int slab_count = Rect3i::difference(prev_box, new_box, slabs);
+	for(int i = 0; i < slab_count; ++i) {
+		remove_collision_area(slabs[i]);
+	}
+
+	slab_count = Rect3i::difference(new_box, prev_box, slabs);
+	for(int i = 0; i < slab_count; ++i) {
+		add_collision_area(slabs[i]);
+	}
+}
+
+void VoxelTerrain::add_collision_area(Rect3i box) {
+	Vector3i max = box.pos + box.size;
+	Vector3i pos;
+	for(pos.z = box.pos.z; pos.z < max.z; ++pos.z) {
+		for(pos.y = box.pos.y; pos.y < max.y; ++pos.y) {
+			for(pos.x = box.pos.x; pos.x < max.x; ++pos.x) {
+				// If the block is dirty, collision will come with its next update.
+				// Otherwise it needs one.
+				VoxelBlock *block = _map->get_block(pos);
+				if(block && !block->has_collision() && !is_block_dirty(pos)) {
+					make_block_dirty(pos);
+				}
+			}
+		}
+	}
+}
+
+void VoxelTerrain::remove_collision_area(Rect3i box) {
+	Vector3i max = box.pos + box.size;
+	Vector3i pos;
+	for(pos.z = box.pos.z; pos.z < max.z; ++pos.z) {
+		for(pos.y = box.pos.y; pos.y < max.y; ++pos.y) {
+			for(pos.x = box.pos.x; pos.x < max.x; ++pos.x) {
+				// Other viewers may still need it
+				if(!is_in_collision_area(pos)) {
+					VoxelBlock *block = _map->get_block(pos);
+					if(block) {
+						block->clear_collision();
+					}
+				}
+			}
+		}
+	}
+}
+
+bool VoxelTerrain::is_in_collision_area(Vector3i bpos) const {
+	const int *key = NULL;
+	while (key = _viewers.next(key)) {
+		const Viewer &viewer = _viewers.get(*key);
+		if(viewer.collision_box.contains(bpos)) {
+			return true;
+		}
+	}
+	return false;
+}
+
 void VoxelTerrain::set_material(int id, Ref<Material> material) {
 	// TODO Update existing block surfaces
 	ERR_FAIL_COND(id < 0 || id >= VoxelMesher::MAX_MATERIALS);
@@ -179,13 +639,20 @@ void VoxelTerrain::make_block_dirty(Vector3i bpos) {
 
 		if(_map->has_block(bpos)) {
 
-			_blocks_pending_update.push_back(bpos);
-			_dirty_blocks[bpos] = BLOCK_UPDATE_NOT_SENT;
+			EvictedBlock *eb = _evicted_blocks.getptr(bpos);
+			if(eb) {
+				// Nobody sees the block, don't mesh it until it is revived
+				eb->needs_update = true;
+			} else {
+				_blocks_pending_update.push_back(bpos);
+				_dirty_blocks[bpos] = BLOCK_UPDATE_NOT_SENT;
+			}
 
-		} else {
+		} else if(_block_refcounts.has(bpos)) {
 			_blocks_pending_load.push_back(bpos);
 			_dirty_blocks[bpos] = BLOCK_LOAD;
 		}
+		// Otherwise no viewer needs the block, don't load it
 
 	} else if(*state == BLOCK_UPDATE_SENT) {
 		// The updater is already processing the block,
@@ -200,18 +667,102 @@ void VoxelTerrain::make_block_dirty(Vector3i bpos) {
 	// this will make the second change ignored, which is not correct!
 }
 
+// Memory an evicted block keeps around. Uniform channels take no data,
+// so a fixed cost makes sure blocks of air or solid ground still count against the budget.
+static size_t get_evicted_block_memory(const VoxelBlock &block) {
+	const size_t overhead = sizeof(VoxelBlock) + sizeof(VoxelBuffer);
+	return overhead + block.voxels->get_memory_usage() + block.get_mesh_memory_usage();
+}
+
+void VoxelTerrain::evict_block(Vector3i bpos) {
+
+	VoxelBlock *block = _map->get_block(bpos);
+	if(block == NULL || _eviction_memory_budget <= 0) {
+		immerge_block(bpos);
+		return;
+	}
+
+	// Keep it hidden in the eviction queue, in case a viewer comes back
+	block->set_visible(false);
+	block->clear_collision();
+
+	EvictedBlock eb;
+	eb.element = _eviction_queue.push_back(bpos);
+	eb.memory = get_evicted_block_memory(*block);
+
+	// An update waiting to be sent would mesh a block nobody sees, so it is postponed until the block is revived.
+	// Its entry in the pending list gets skipped, since the block is no longer dirty.
+	VoxelTerrain::BlockDirtyState *state = _dirty_blocks.getptr(bpos);
+	eb.needs_update = state && *state == BLOCK_UPDATE_NOT_SENT;
+	if(eb.needs_update) {
+		_dirty_blocks.erase(bpos);
+	}
+	_evicted_blocks[bpos] = eb;
+	_eviction_queue_memory += eb.memory;
+
+	trim_eviction_queue(_eviction_memory_budget);
+}
+
+bool VoxelTerrain::revive_block(Vector3i bpos) {
+
+	EvictedBlock *eb = _evicted_blocks.getptr(bpos);
+	if(eb == NULL) {
+		return false;
+	}
+
+	const bool needs_update = eb->needs_update;
+	_eviction_queue.erase(eb->element);
+	_eviction_queue_memory -= eb->memory;
+	_evicted_blocks.erase(bpos);
+
+	VoxelBlock *block = _map->get_block(bpos);
+	ERR_FAIL_COND_V(block == NULL, false);
+	block->set_visible(is_visible());
+	if(needs_update) {
+		make_block_dirty(bpos);
+	}
+	// Collision comes back with the collision area if needed
+
+	return true;
+}
+
+void VoxelTerrain::trim_eviction_queue(size_t max_memory) {
+	// Unload least recently evicted blocks first.
+	// A budget of zero empties the queue, whatever blocks are said to cost.
+	while(_eviction_queue.size() != 0 && (max_memory == 0 || _eviction_queue_memory > max_memory)) {
+		immerge_block(_eviction_queue.front()->get());
+	}
+}
+
 void VoxelTerrain::immerge_block(Vector3i bpos) {
 
 	ERR_FAIL_COND(_map.is_null());
 
+	EvictedBlock *eb = _evicted_blocks.getptr(bpos);
+	if(eb) {
+		_eviction_queue.erase(eb->element);
+		_eviction_queue_memory -= eb->memory;
+		_evicted_blocks.erase(bpos);
+	}
+
 	// TODO Schedule block saving when supported
 	_map->remove_block(bpos, VoxelMap::NoAction());
 
 	_dirty_blocks.erase(bpos);
+	_block_update_sequences.erase(bpos);
+	_block_edit_times.erase(bpos);
+	_block_load_times.erase(bpos);
 	// Blocks in the update queue will be cancelled in _process,
 	// because it's too expensive to linear-search all blocks for each block
 }
 
+#ifdef VOXEL_PROFILING
+Error VoxelTerrain::save_profiling_trace(String path) {
+	ERR_FAIL_COND_V(ZProfiler::get_singleton() == NULL, ERR_UNCONFIGURED);
+	return ZProfiler::get_singleton()->save_chrome_trace(path);
+}
+#endif
+
 Dictionary VoxelTerrain::get_statistics() const {
 
 	Dictionary provider;
@@ -228,6 +779,8 @@ Dictionary VoxelTerrain::get_statistics() const {
 	updater["mesh_alloc_time"] = _stats.mesh_alloc_time;
 	updater["dropped_blocks"] = _stats.dropped_updater_blocks;
 	updater["remaining_main_thread_blocks"] = _stats.remaining_main_thread_blocks;
+	updater["skipped_model_meshes"] = _stats.skipped_model_meshes;
+	updater["skipped_smooth_meshes"] = _stats.skipped_smooth_meshes;
 
 	Dictionary d;
 	d["provider"] = provider;
@@ -239,6 +792,39 @@ Dictionary VoxelTerrain::get_statistics() const {
 	d["time_process_load_responses"] = _stats.time_process_load_responses;
 	d["time_send_update_requests"] = _stats.time_send_update_requests;
 	d["time_process_update_responses"] = _stats.time_process_update_responses;
+	d["time_cave_culling"] = _stats.time_cave_culling;
+
+	d["culled_blocks"] = _stats.culled_blocks;
+
+	d["last_edit_latency"] = _stats.last_edit_latency;
+	d["max_edit_latency"] = _stats.max_edit_latency;
+
+	// Blocks waiting for something. Should go back to zero once the terrain stops changing.
+	int blocks_loading = 0;
+	int blocks_update_not_sent = 0;
+	int blocks_update_sent = 0;
+	const Vector3i *key = NULL;
+	while (key = _dirty_blocks.next(key)) {
+		switch (_dirty_blocks.get(*key)) {
+			case BLOCK_LOAD:
+				++blocks_loading;
+				break;
+			case BLOCK_UPDATE_NOT_SENT:
+				++blocks_update_not_sent;
+				break;
+			case BLOCK_UPDATE_SENT:
+				++blocks_update_sent;
+				break;
+			default:
+				break;
+		}
+	}
+	d["blocks_loading"] = blocks_loading;
+	d["blocks_update_not_sent"] = blocks_update_not_sent;
+	d["blocks_update_sent"] = blocks_update_sent;
+
+	d["evicted_blocks"] = _eviction_queue.size();
+	d["evicted_blocks_memory"] = (int64_t)_eviction_queue_memory;
 
 	return d;
 }
@@ -263,7 +849,7 @@ void VoxelTerrain::make_all_view_dirty_deferred() {
 	// This trick will regenerate all chunks in view, according to the view distance found during block updates.
 	// The point of doing this instead of immediately scheduling updates is that it will
 	// always use an up-to-date view distance, which is not necessarily loaded yet on initialization.
-	_last_view_distance_blocks = 0;
+	_all_view_dirty = true;
 
 //	Vector3i radius(_view_distance_blocks, _view_distance_blocks, _view_distance_blocks);
 //	make_blocks_dirty(-radius, 2*radius);
@@ -273,11 +859,168 @@ inline int get_border_index(int x, int max) {
 	return x == 0 ? 0 : x != max ? 1 : 2;
 }
 
+int VoxelTerrain::get_low_latency_edit_distance() const {
+	return _low_latency_edit_distance_blocks * _map->get_block_size();
+}
+
+void VoxelTerrain::set_low_latency_edit_distance(int distance_in_voxels) {
+	ERR_FAIL_COND(distance_in_voxels < 0);
+	_low_latency_edit_distance_blocks = distance_in_voxels / _map->get_block_size();
+}
+
+void VoxelTerrain::make_edited_block_dirty(Vector3i bpos) {
+	if(_map->has_block(bpos) && !_block_edit_times.has(bpos)) {
+		_block_edit_times[bpos] = OS::get_singleton()->get_ticks_usec();
+	}
+	make_block_dirty(bpos);
+}
+
+bool VoxelTerrain::is_in_low_latency_area(Vector3i bpos) const {
+
+	if(_low_latency_edit_distance_blocks <= 0) {
+		return false;
+	}
+
+	const int d2 = _low_latency_edit_distance_blocks * _low_latency_edit_distance_blocks;
+
+	const int *key = NULL;
+	while (key = _viewers.next(key)) {
+		const Viewer &viewer = _viewers.get(*key);
+		if(viewer.view_distance_blocks > 0 && viewer.block_position.distance_sq(bpos) <= d2) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void VoxelTerrain::record_edit_latency(Vector3i bpos) {
+
+	const uint64_t *time = _block_edit_times.getptr(bpos);
+	if(time == NULL) {
+		return;
+	}
+
+	uint64_t latency = OS::get_singleton()->get_ticks_usec() - *time;
+	_stats.last_edit_latency = latency;
+	if(latency > _stats.max_edit_latency) {
+		_stats.max_edit_latency = latency;
+	}
+
+	_block_edit_times.erase(bpos);
+}
+
+void VoxelTerrain::record_load_latency(Vector3i bpos) {
+
+	const uint64_t *time = _block_load_times.getptr(bpos);
+	if(time == NULL) {
+		return;
+	}
+
+	_latency_stats.total.add(OS::get_singleton()->get_ticks_usec() - *time);
+	_block_load_times.erase(bpos);
+}
+
+Dictionary VoxelTerrain::get_latency_statistics() const {
+	Dictionary d;
+	d["load_queue"] = _latency_stats.load_queue.to_dictionary();
+	d["generation"] = _latency_stats.generation.to_dictionary();
+	d["mesh_queue"] = _latency_stats.mesh_queue.to_dictionary();
+	d["meshing"] = _latency_stats.meshing.to_dictionary();
+	d["upload"] = _latency_stats.upload.to_dictionary();
+	d["total"] = _latency_stats.total.to_dictionary();
+	return d;
+}
+
+void VoxelTerrain::reset_latency_statistics() {
+	_latency_stats = LatencyStats();
+}
+
+void VoxelTerrain::begin_edit() {
+	++_edit_depth;
+}
+
+void VoxelTerrain::end_edit() {
+	ERR_FAIL_COND(_edit_depth == 0);
+	--_edit_depth;
+	if(_edit_depth == 0) {
+		commit_edit();
+	}
+}
+
+void VoxelTerrain::add_edited_area(Rect3i voxel_box) {
+
+	if(voxel_box.is_empty()) {
+		return;
+	}
+
+	if(_edited_voxels.is_empty()) {
+		_edited_voxels = voxel_box;
+	} else {
+		_edited_voxels = Rect3i::get_bounding_box(_edited_voxels, voxel_box);
+	}
+
+	Vector3i min_bpos = _map->voxel_to_block(voxel_box.pos);
+	Vector3i max_bpos = _map->voxel_to_block(voxel_box.pos + voxel_box.size - Vector3i(1, 1, 1));
+
+	Vector3i bpos;
+	for(bpos.z = min_bpos.z; bpos.z <= max_bpos.z; ++bpos.z) {
+		for(bpos.x = min_bpos.x; bpos.x <= max_bpos.x; ++bpos.x) {
+			for(bpos.y = min_bpos.y; bpos.y <= max_bpos.y; ++bpos.y) {
+				_edited_blocks.set(bpos, true);
+			}
+		}
+	}
+}
+
+void VoxelTerrain::commit_edit() {
+
+	if(_edited_blocks.size() == 0) {
+		return;
+	}
+
+	// Neighbor blocks need an update too if they are close enough to edited voxels
+	// to include them in their padding or ambient occlusion
+	Rect3i area = _edited_voxels;
+	area.pos -= Vector3i(1, 1, 1);
+	area.size += Vector3i(2, 2, 2);
+
+	const Vector3i block_size(_map->get_block_size());
+	HashMap<Vector3i, bool, Vector3iHasher> blocks_to_update;
+
+	const Vector3i *key = NULL;
+	while (key = _edited_blocks.next(key)) {
+		Vector3i ndir;
+		for(ndir.z = -1; ndir.z < 2; ++ndir.z) {
+			for(ndir.x = -1; ndir.x < 2; ++ndir.x) {
+				for(ndir.y = -1; ndir.y < 2; ++ndir.y) {
+					Vector3i npos = *key + ndir;
+					if(Rect3i(_map->block_to_voxel(npos), block_size).intersects(area)) {
+						blocks_to_update.set(npos, true);
+					}
+				}
+			}
+		}
+	}
+
+	key = NULL;
+	while (key = blocks_to_update.next(key)) {
+		make_edited_block_dirty(*key);
+	}
+
+	_edited_blocks.clear();
+	_edited_voxels = Rect3i();
+}
+
 void VoxelTerrain::make_voxel_dirty(Vector3i pos) {
 
+	if(_edit_depth > 0) {
+		add_edited_area(Rect3i(pos, Vector3i(1, 1, 1)));
+		return;
+	}
+
 	// Update the block in which the voxel is
 	Vector3i bpos = _map->voxel_to_block(pos);
-	make_block_dirty(bpos);
+	make_edited_block_dirty(bpos);
 	//OS::get_singleton()->print("Dirty (%i, %i, %i)\n", bpos.x, bpos.y, bpos.z);
 
 	// Update neighbor blocks if the voxel is touching a boundary
@@ -290,19 +1033,19 @@ void VoxelTerrain::make_voxel_dirty(Vector3i pos) {
 	const int max = _map->get_block_size() - 1;
 
 	if (rpos.x == 0)
-		make_block_dirty(bpos - Vector3i(1, 0, 0));
+		make_edited_block_dirty(bpos - Vector3i(1, 0, 0));
 	else if (rpos.x == max)
-		make_block_dirty(bpos + Vector3i(1, 0, 0));
+		make_edited_block_dirty(bpos + Vector3i(1, 0, 0));
 
 	if (rpos.y == 0)
-		make_block_dirty(bpos - Vector3i(0, 1, 0));
+		make_edited_block_dirty(bpos - Vector3i(0, 1, 0));
 	else if (rpos.y == max)
-		make_block_dirty(bpos + Vector3i(0, 1, 0));
+		make_edited_block_dirty(bpos + Vector3i(0, 1, 0));
 
 	if (rpos.z == 0)
-		make_block_dirty(bpos - Vector3i(0, 0, 1));
+		make_edited_block_dirty(bpos - Vector3i(0, 0, 1));
 	else if (rpos.z == max)
-		make_block_dirty(bpos + Vector3i(0, 0, 1));
+		make_edited_block_dirty(bpos + Vector3i(0, 0, 1));
 
 	// We might want to update blocks in corners in order to update ambient occlusion
 	if (check_corners) {
@@ -378,13 +1121,18 @@ void VoxelTerrain::make_voxel_dirty(Vector3i pos) {
 			const int *normal = normals[ce_indexes[i]];
 			Vector3i nbpos(bpos.x + normal[0], bpos.y + normal[1], bpos.z + normal[2]);
 			//OS::get_singleton()->print("Corner dirty (%i, %i, %i)\n", nbpos.x, nbpos.y, nbpos.z);
-			make_block_dirty(nbpos);
+			make_edited_block_dirty(nbpos);
 		}
 	}
 }
 
 void VoxelTerrain::make_area_dirty(Rect3i box) {
 
+	if(_edit_depth > 0) {
+		add_edited_area(box);
+		return;
+	}
+
 	Vector3i min_pos = box.pos;
 	Vector3i max_pos = box.pos + box.size - Vector3(1, 1, 1);
 
@@ -423,12 +1171,70 @@ void VoxelTerrain::make_area_dirty(Rect3i box) {
 		for (bpos.x = min_block_pos.x; bpos.x <= max_block_pos.x; ++bpos.x) {
 			for (bpos.y = min_block_pos.y; bpos.y <= max_block_pos.y; ++bpos.y) {
 
-				make_block_dirty(bpos);
+				make_edited_block_dirty(bpos);
 			}
 		}
 	}
 }
 
+struct SphereSdf {
+	Vector3 center;
+	real_t radius;
+
+	inline float operator()(const Vector3 &pos) const {
+		return pos.distance_to(center) - radius;
+	}
+};
+
+struct BoxSdf {
+	Vector3 center;
+	Vector3 half_size;
+
+	inline float operator()(const Vector3 &pos) const {
+		Vector3 d = (pos - center).abs() - half_size;
+		Vector3 outside(MAX(d.x, 0), MAX(d.y, 0), MAX(d.z, 0));
+		return outside.length() + MIN(MAX(d.x, MAX(d.y, d.z)), 0);
+	}
+};
+
+void VoxelTerrain::do_sphere(Vector3 center, real_t radius, int value, unsigned int channel) {
+
+	ERR_FAIL_COND(radius < 0);
+
+	SphereSdf sdf;
+	sdf.center = center;
+	sdf.radius = radius;
+
+	// Smooth edits also blend voxels close to the surface
+	real_t margin = channel == Voxel::CHANNEL_ISOLEVEL ? 2 : 0;
+	Vector3 extents(radius + margin, radius + margin, radius + margin);
+
+	Vector3i min = center - extents;
+	Vector3i max = Vector3i(center + extents) + Vector3i(1, 1, 1);
+
+	do_sdf_op(Rect3i(min, max - min), sdf, value, channel);
+}
+
+void VoxelTerrain::do_box(Vector3i begin, Vector3i end, int value, unsigned int channel) {
+
+	Vector3i::sort_min_max(begin, end);
+
+	// Voxels from begin to end excluded are inside
+	BoxSdf sdf;
+	sdf.half_size = (end - begin - Vector3i(1, 1, 1)).to_vec3() * 0.5;
+	sdf.center = begin.to_vec3() + sdf.half_size;
+
+	Rect3i box(begin, end - begin);
+	if (channel == Voxel::CHANNEL_ISOLEVEL) {
+		// Smooth edits also blend voxels close to the surface
+		const int margin = 2;
+		box.pos -= Vector3i(margin, margin, margin);
+		box.size += Vector3i(2 * margin, 2 * margin, 2 * margin);
+	}
+
+	do_sdf_op(box, sdf, value, channel);
+}
+
 struct EnterWorldAction {
 	World *world;
 	EnterWorldAction(World *w) : world(w) {}
@@ -451,6 +1257,17 @@ struct SetVisibilityAction {
 	}
 };
 
+void VoxelTerrain::reset_block_visibility() {
+	_map->for_all_blocks(SetVisibilityAction(is_visible()));
+	// Evicted blocks stay hidden
+	for(const List<Vector3i>::Element *E = _eviction_queue.front(); E; E = E->next()) {
+		VoxelBlock *block = _map->get_block(E->get());
+		if(block) {
+			block->set_visible(false);
+		}
+	}
+}
+
 void VoxelTerrain::_notification(int p_what) {
 
 	switch (p_what) {
@@ -479,38 +1296,121 @@ void VoxelTerrain::_notification(int p_what) {
 
 		case NOTIFICATION_VISIBILITY_CHANGED:
 			ERR_FAIL_COND(_map.is_null());
-			_map->for_all_blocks(SetVisibilityAction(is_visible()));
+			// If cave culling is enabled, it will hide blocks again in _process
+			reset_block_visibility();
 			break;
 
 		// TODO Listen for transform changes
 
-		default:
-			break;
+		default:
+			break;
+	}
+}
+
+static inline bool is_mesh_empty(Ref<Mesh> mesh_ref) {
+	if (mesh_ref.is_null())
+		return true;
+	const Mesh &mesh = **mesh_ref;
+	if (mesh.get_surface_count() == 0)
+		return true;
+	if (mesh.surface_get_array_len(0) == 0)
+		return true;
+	return false;
+}
+
+// Summary of a block, or of what the map copies in its place when it's not loaded.
+// Returns false if it can't be trusted.
+static bool get_block_summary(const VoxelMap &map, Vector3i bpos, VoxelBuffer::Summary &out_summary) {
+
+	const VoxelBlock *block = map.get_block(bpos);
+	if (block != NULL && block->voxels.is_valid()) {
+		out_summary = block->voxels->get_summary();
+		return out_summary.valid;
+	}
+
+	for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+		out_summary.min[i] = map.get_default_voxel(i);
+		out_summary.max[i] = map.get_default_voxel(i);
+	}
+	const unsigned int block_size = map.get_block_size();
+	const bool air = map.get_default_voxel(Voxel::CHANNEL_TYPE) == 0;
+	out_summary.non_air_count = air ? 0 : block_size * block_size * block_size;
+	out_summary.full_sides = air ? 0 : (1 << Cube::SIDE_COUNT) - 1;
+	out_summary.valid = true;
+	return true;
+}
+
+// Tells if all voxel types in the range are known and hide faces behind them
+static bool are_types_opaque(const VoxelLibrary &library, int min_type, int max_type) {
+	for (int type = min_type; type <= max_type; ++type) {
+		if (!library.has_voxel(type) || library.get_voxel_const(type).is_transparent())
+			return false;
 	}
+	return true;
 }
 
-void VoxelTerrain::remove_positions_outside_box(Vector<Vector3i> &positions, Rect3i box, HashMap<Vector3i, VoxelTerrain::BlockDirtyState, Vector3iHasher> &state_map) {
-	for(int i = 0; i < positions.size(); ++i) {
-		const Vector3i bpos = positions[i];
-		if(!box.contains(bpos)) {
-			int last = positions.size() - 1;
-			positions.write[i] = positions[last];
-			positions.resize(last);
-			state_map.erase(bpos);
-			--i;
+// Tells which meshers can produce something for a block, using summaries instead of voxels.
+// When a summary is missing, the mesher is assumed to be needed.
+static void get_required_meshers(const VoxelMap &map, const VoxelLibrary &library, Vector3i bpos, bool &out_model, bool &out_smooth) {
+
+	out_model = true;
+	out_smooth = true;
+
+	VoxelBuffer::Summary summary;
+	if (!get_block_summary(map, bpos, summary))
+		return;
+
+	// The smooth mesher sees padding from all neighbors, and only makes triangles where isolevels change sign.
+	int iso_min = summary.min[Voxel::CHANNEL_ISOLEVEL];
+	int iso_max = summary.max[Voxel::CHANNEL_ISOLEVEL];
+	bool neighbors_known = true;
+	Vector3i d;
+	for (d.z = -1; d.z <= 1 && neighbors_known; ++d.z) {
+		for (d.x = -1; d.x <= 1 && neighbors_known; ++d.x) {
+			for (d.y = -1; d.y <= 1; ++d.y) {
+				VoxelBuffer::Summary ns;
+				if (!get_block_summary(map, bpos + d, ns)) {
+					neighbors_known = false;
+					break;
+				}
+				iso_min = MIN(iso_min, ns.min[Voxel::CHANNEL_ISOLEVEL]);
+				iso_max = MAX(iso_max, ns.max[Voxel::CHANNEL_ISOLEVEL]);
+			}
 		}
 	}
-}
+	if (neighbors_known) {
+		// Matter is below 128
+		out_smooth = iso_min < 128 && iso_max >= 128;
+	}
 
-static inline bool is_mesh_empty(Ref<Mesh> mesh_ref) {
-	if (mesh_ref.is_null())
-		return true;
-	const Mesh &mesh = **mesh_ref;
-	if (mesh.get_surface_count() == 0)
-		return true;
-	if (mesh.surface_get_array_len(0) == 0)
-		return true;
-	return false;
+	// The model mesher only meshes voxels of the block, but looks at neighbors to hide faces
+	const int type_min = summary.min[Voxel::CHANNEL_TYPE];
+	const int type_max = summary.max[Voxel::CHANNEL_TYPE];
+	if (type_max == 0) {
+		// Only air
+		out_model = false;
+		return;
+	}
+	if (type_min == 0 || !are_types_opaque(library, type_min, type_max)) {
+		// Faces can show inside the block
+		return;
+	}
+
+	for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+		VoxelBuffer::Summary ns;
+		if (!get_block_summary(map, bpos + Cube::g_side_normals[side], ns))
+			return;
+		// Sides come in pairs, so the neighbor touches the block with the other side of the pair
+		const unsigned int opposite_side = side ^ 1;
+		if ((ns.full_sides & (1 << opposite_side)) == 0)
+			return;
+		// Only non-air voxels are on a full side
+		if (!are_types_opaque(library, MAX(1, ns.min[Voxel::CHANNEL_TYPE]), ns.max[Voxel::CHANNEL_TYPE]))
+			return;
+	}
+
+	// Enclosed by opaque voxels, no face can be seen
+	out_model = false;
 }
 
 void VoxelTerrain::_process() {
@@ -520,74 +1420,129 @@ void VoxelTerrain::_process() {
 
 	ERR_FAIL_COND(_map.is_null());
 
+	VOXEL_PROFILE_SCOPE("VoxelTerrain::_process");
+
 	uint64_t time_before = os.get_ticks_usec();
 
-	// Get viewer location
+	// Get location of the viewer driven by the node path.
+	// It stays inactive if viewers were registered from script and no node was given.
 	// TODO Transform to local (Spatial Transform)
-	Vector3i viewer_block_pos;
-	if(engine.is_editor_hint()) {
-		// TODO Use editor's camera here
-		viewer_block_pos = Vector3i();
-	} else {
-		Spatial *viewer = get_viewer(_viewer_path);
-		if (viewer)
-			viewer_block_pos = _map->voxel_to_block(viewer->get_translation());
-		else
-			viewer_block_pos = Vector3i();
-	}
-
-	// Find out which blocks need to appear and which need to be unloaded
 	{
-		//Vector3i viewer_block_pos_delta = _last_viewer_block_pos - viewer_block_pos;
-		Rect3i new_box = Rect3i::from_center_extents(viewer_block_pos, Vector3i(_view_distance_blocks));
-		Rect3i prev_box = Rect3i::from_center_extents(_last_viewer_block_pos, Vector3i(_last_view_distance_blocks));
-
-		if(prev_box != new_box) {
-			//print_line(String("Loaded area changed: from ") + prev_box.to_string() + String(" to ") + new_box.to_string());
-
-			Rect3i bounds = Rect3i::get_bounding_box(prev_box, new_box);
-			Vector3i max = bounds.pos + bounds.size;
+		VOXEL_PROFILE_SCOPE("VoxelTerrain::_process update default viewer");
+		Viewer *default_viewer = _viewers.getptr(DEFAULT_VIEWER_ID);
+		CRASH_COND(default_viewer == NULL);
+
+		default_viewer->position = Vector3();
+		default_viewer->direction = Vector3();
+
+		if(!engine.is_editor_hint()) {
+			// TODO Use editor's camera in the editor
+			Spatial *viewer = get_viewer(_viewer_path);
+			if (viewer) {
+				Transform transform = viewer->get_transform();
+				default_viewer->position = transform.origin;
+				// Cameras look towards -Z
+				default_viewer->direction = -transform.basis.get_axis(Vector3::AXIS_Z).normalized();
+			}
+		}
 
-			// TODO There should be a way to only iterate relevant blocks
-			Vector3i pos;
-			for(pos.z = bounds.pos.z; pos.z < max.z; ++pos.z) {
-				for(pos.y = bounds.pos.y; pos.y < max.y; ++pos.y) {
-					for(pos.x = bounds.pos.x; pos.x < max.x; ++pos.x) {
+		bool active = !_viewer_path.is_empty() || _viewers.size() == 1;
+		default_viewer->view_distance_blocks = active ? _view_distance_blocks : 0;
+	}
 
-						bool prev_contains = prev_box.contains(pos);
-						bool new_contains = new_box.contains(pos);
+	// Find out which blocks need to appear and which need to be unloaded.
+	// Every viewer references blocks around it, and blocks get unloaded when no viewer references them anymore.
+	// Blocks closest to where viewers will soon be are processed first.
+	VoxelBlockPriority priority;
+	priority.direction_weight = _prefetch_direction_weight;
+	{
+		VOXEL_PROFILE_SCOPE("VoxelTerrain::_process update view regions");
+		const float delta = get_process_delta_time();
+
+		const int *key = NULL;
+		while (key = _viewers.next(key)) {
+			Viewer &viewer = _viewers.get(*key);
+
+			update_viewer_motion(viewer, delta);
+
+			viewer.block_position = _map->voxel_to_block(viewer.position);
+			set_viewer_region(viewer,
+					get_view_region(viewer.block_position, viewer.view_distance_blocks, 0),
+					get_view_region(viewer.block_position, viewer.view_distance_blocks, _unload_margin_blocks));
+
+			if(viewer.view_distance_blocks > 0) {
+				Vector3 direction;
+				if (_prefetch_direction_weight > 0) {
+					direction = viewer.direction;
+					if (*key != DEFAULT_VIEWER_ID || direction == Vector3()) {
+						direction = viewer.velocity.normalized();
+					}
+					// Coarse steps, so queues don't get re-sorted every time the camera turns a little
+					const float step = 0.25;
+					direction = Vector3(
+							Math::stepify(direction.x, step),
+							Math::stepify(direction.y, step),
+							Math::stepify(direction.z, step));
+					direction.normalize();
+				}
+				priority.add_point(get_predicted_block_position(viewer), direction);
+			}
+		}
 
-						if(prev_contains && !new_contains) {
-							// Unload block
-							immerge_block(pos);
+		if(_all_view_dirty) {
+			// Evicted blocks are outdated, no need to keep them
+			trim_eviction_queue(0);
 
-						} else if(!prev_contains && new_contains) {
-							// Load or update block
-							make_block_dirty(pos);
-						}
-					}
+			const Vector3i *bpos = NULL;
+			while (bpos = _block_retain_refcounts.next(bpos)) {
+				// Only load blocks in view, retained ones just get updated
+				if(_block_refcounts.has(*bpos) || _map->has_block(*bpos)) {
+					make_block_dirty(*bpos);
 				}
 			}
+			_all_view_dirty = false;
 		}
 
-		// Eliminate pending blocks that aren't needed
-		remove_positions_outside_box(_blocks_pending_load, new_box, _dirty_blocks);
-		remove_positions_outside_box(_blocks_pending_update, new_box, _dirty_blocks);
+		// Note: pending blocks that aren't needed anymore are skipped when requests are sent,
+		// instead of searching them each time blocks get unloaded
 	}
 
-	_stats.time_detect_required_blocks = os.get_ticks_usec() - time_before;
+	// Find out which blocks need collision, and which ones don't need it anymore.
+	// Collision is built along with meshes, so it can't go further than the view distance.
+	{
+		const int *key = NULL;
+		while (key = _viewers.next(key)) {
+			Viewer &viewer = _viewers.get(*key);
+			int d = _generate_collisions ? MIN(_collision_distance_blocks, viewer.view_distance_blocks) : 0;
+			set_viewer_collision_box(viewer, Rect3i::from_center_extents(viewer.block_position, Vector3i(d)));
+		}
+	}
 
-	_last_view_distance_blocks = _view_distance_blocks;
-	_last_viewer_block_pos = viewer_block_pos;
+	_stats.time_detect_required_blocks = os.get_ticks_usec() - time_before;
 
 	time_before = os.get_ticks_usec();
 
 	// Send block loading requests
 	{
+		VOXEL_PROFILE_SCOPE("VoxelTerrain::_process send load requests");
 		VoxelProviderThread::InputData input;
 
-		input.priority_block_position = viewer_block_pos;
-		input.blocks_to_emerge.append_array(_blocks_pending_load);
+		input.priority = priority;
+
+		// A block unloaded and requested again before this runs appears twice
+		HashMap<Vector3i, bool, Vector3iHasher> requested;
+
+		for(int i = 0; i < _blocks_pending_load.size(); ++i) {
+			Vector3i bpos = _blocks_pending_load[i];
+			const VoxelTerrain::BlockDirtyState *state = _dirty_blocks.getptr(bpos);
+			if(state && *state == BLOCK_LOAD && !requested.has(bpos)) {
+				requested[bpos] = true;
+				VOXEL_PROFILE_MARK("VoxelTerrain request block load", ZProfiler::get_block_correlation_id(bpos));
+				input.blocks_to_emerge.push_back(bpos);
+				_block_load_times[bpos] = os.get_ticks_usec();
+			}
+			// Otherwise the block got unloaded in the meantime, or was already requested
+		}
 		//input.blocks_to_immerge.append_array();
 
 		//print_line(String("Sending {0} block requests").format(varray(input.blocks_to_emerge.size())));
@@ -602,6 +1557,8 @@ void VoxelTerrain::_process() {
 	// Get block loading responses
 	// Note: if block loading is too fast, this can cause stutters. It should only happen on first load, though.
 	{
+		VOXEL_PROFILE_SCOPE("VoxelTerrain::_process receive blocks");
+
 		const unsigned int bs = _map->get_block_size();
 		const Vector3i block_size(bs, bs, bs);
 
@@ -626,6 +1583,12 @@ void VoxelTerrain::_process() {
 				}
 			}
 
+			const uint64_t *load_time = _block_load_times.getptr(block_pos);
+			if (load_time && o.begin_time >= *load_time) {
+				_latency_stats.load_queue.add(o.begin_time - *load_time);
+			}
+			_latency_stats.generation.add(o.end_time - o.begin_time);
+
 			// Check return
 			// TODO Shouldn't halt execution though, as it can bring the map in an invalid state!
 			ERR_FAIL_COND(o.voxels->get_size() != block_size);
@@ -638,7 +1601,8 @@ void VoxelTerrain::_process() {
 
 			// Trigger mesh updates
 			if (update_neighbors) {
-				// All neighbors have to be checked. If they are now surrounded, they can be updated
+				// All neighbors have to be checked. If they are now surrounded, they can be updated.
+				// This is cheap because the map keeps count of loaded neighbors for each block.
 				Vector3i ndir;
 				for (ndir.z = -1; ndir.z < 2; ++ndir.z) {
 					for (ndir.x = -1; ndir.x < 2; ++ndir.x) {
@@ -675,7 +1639,12 @@ void VoxelTerrain::_process() {
 
 	// Send mesh updates
 	{
+		VOXEL_PROFILE_SCOPE("VoxelTerrain::_process send mesh updates");
 		VoxelMeshUpdater::Input input;
+		input.priority = priority;
+		Ref<World> world = get_world();
+		_stats.skipped_model_meshes = 0;
+		_stats.skipped_smooth_meshes = 0;
 
 		for(int i = 0; i < _blocks_pending_update.size(); ++i) {
 			Vector3i block_pos = _blocks_pending_update[i];
@@ -688,19 +1657,63 @@ void VoxelTerrain::_process() {
 			CRASH_COND(block->voxels.is_null());
 
 			VoxelTerrain::BlockDirtyState *block_state = _dirty_blocks.getptr(block_pos);
-			CRASH_COND(block_state == NULL);
-			CRASH_COND(*block_state != BLOCK_UPDATE_NOT_SENT);
-
-			int air_type = 0;
-			if(block->voxels->is_uniform(Voxel::CHANNEL_TYPE) && block->voxels->get_voxel(0, 0, 0, Voxel::CHANNEL_TYPE) == air_type) {
+			if (block_state == NULL || *block_state != BLOCK_UPDATE_NOT_SENT) {
+				// The block was unloaded and loaded again since it was scheduled,
+				// so this is a stale entry
+				continue;
+			}
 
-				// The block contains empty voxels
-				block->set_mesh(Ref<Mesh>(), Ref<World>());
+			EvictedBlock *eb = _evicted_blocks.getptr(block_pos);
+			if (eb) {
+				// Nobody sees the block, it will be updated if it is revived
+				eb->needs_update = true;
 				_dirty_blocks.erase(block_pos);
+				continue;
+			}
 
-				// Optional, but I guess it might spare some memory
-				block->voxels->clear_channel(Voxel::CHANNEL_TYPE, air_type);
+			const bool build_collision = is_in_collision_area(block_pos);
+
+			if(_block_updater == NULL || (!_generate_meshes && !build_collision)) {
+				// Nothing to build for this block
+				_dirty_blocks.erase(block_pos);
+				_block_update_sequences.erase(block_pos);
+				record_edit_latency(block_pos);
+				record_load_latency(block_pos);
+				continue;
+			}
 
+			bool mesh_model = true;
+			bool mesh_smooth = true;
+			if (_library.is_valid()) {
+				get_required_meshers(*_map, **_library, block_pos, mesh_model, mesh_smooth);
+			}
+			if (!mesh_model)
+				++_stats.skipped_model_meshes;
+			if (!mesh_smooth)
+				++_stats.skipped_smooth_meshes;
+
+			// Collision boxes are made from voxels of the block, even if their faces are hidden
+			const VoxelBuffer::Summary &summary = block->voxels->get_summary();
+			const bool has_model_voxels = !summary.valid || summary.max[Voxel::CHANNEL_TYPE] != 0;
+
+			if (!mesh_smooth && (build_collision ? !has_model_voxels : !mesh_model)) {
+
+				// Meshers would produce nothing
+				if(_generate_meshes) {
+					block->set_mesh(Ref<Mesh>(), Ref<World>());
+					// Either the block is only air, or it is opaque and enclosed
+					block->side_connections = has_model_voxels ? 0 : VOXEL_ALL_SIDES_CONNECTED;
+				}
+				if(build_collision) {
+					block->set_collision(Vector<AABB>(), PoolVector<Vector3>(), world, get_instance_id());
+				} else {
+					block->clear_collision();
+				}
+				_dirty_blocks.erase(block_pos);
+				// Results of updates sent before are outdated
+				_block_update_sequences.erase(block_pos);
+				record_edit_latency(block_pos);
+				record_load_latency(block_pos);
 				continue;
 			}
 
@@ -718,12 +1731,24 @@ void VoxelTerrain::_process() {
 			VoxelMeshUpdater::InputBlock iblock;
 			iblock.voxels = nbuffer;
 			iblock.position = block_pos;
+			iblock.build_mesh = _generate_meshes;
+			iblock.build_collision = build_collision;
+			iblock.mesh_model = mesh_model;
+			iblock.mesh_smooth = mesh_smooth;
+			iblock.build_side_connections = _cave_culling;
+			iblock.urgent = _block_edit_times.has(block_pos) && is_in_low_latency_area(block_pos);
+			iblock.request_time = os.get_ticks_usec();
+			iblock.sequence = ++_next_update_sequence;
+			_block_update_sequences[block_pos] = iblock.sequence;
 			input.blocks.push_back(iblock);
+			VOXEL_PROFILE_MARK("VoxelTerrain request block mesh", ZProfiler::get_block_correlation_id(block_pos));
 
 			*block_state = BLOCK_UPDATE_SENT;
 		}
 
-		_block_updater->push(input);
+		if(_block_updater) {
+			_block_updater->push(input);
+		}
 		_blocks_pending_update.clear();
 	}
 
@@ -732,7 +1757,8 @@ void VoxelTerrain::_process() {
 
 	// Get mesh updates
 	{
-		{
+		VOXEL_PROFILE_SCOPE("VoxelTerrain::_process apply mesh updates");
+		if(_block_updater) {
 			VoxelMeshUpdater::Output output;
 			_block_updater->pop(output);
 
@@ -740,7 +1766,20 @@ void VoxelTerrain::_process() {
 			_stats.updated_blocks = output.blocks.size();
 			_stats.dropped_updater_blocks = 0;
 
-			_blocks_pending_main_thread_update.append_array(output.blocks);
+			// Edited blocks are shown before anything else
+			Vector<VoxelMeshUpdater::OutputBlock> urgent_blocks;
+			for(int i = 0; i < output.blocks.size(); ++i) {
+				const VoxelMeshUpdater::OutputBlock &ob = output.blocks[i];
+				if(ob.urgent) {
+					urgent_blocks.push_back(ob);
+				} else {
+					_blocks_pending_main_thread_update.push_back(ob);
+				}
+			}
+			if(!urgent_blocks.empty()) {
+				urgent_blocks.append_array(_blocks_pending_main_thread_update);
+				_blocks_pending_main_thread_update = urgent_blocks;
+			}
 		}
 
 		Ref<World> world = get_world();
@@ -756,6 +1795,18 @@ void VoxelTerrain::_process() {
 
 			const VoxelMeshUpdater::OutputBlock &ob = _blocks_pending_main_thread_update[queue_index];
 
+			VOXEL_PROFILE_SCOPE_ID("VoxelTerrain apply block mesh", ZProfiler::get_block_correlation_id(ob.position));
+			const uint64_t apply_begin_time = os.get_ticks_usec();
+
+			const uint32_t *sequence = _block_update_sequences.getptr(ob.position);
+			if (sequence == NULL || *sequence != ob.sequence) {
+				// A more recent update was sent for that block, or it was unloaded.
+				// Urgent results are applied first, so this one can come after the more recent one.
+				++_stats.dropped_updater_blocks;
+				continue;
+			}
+			_block_update_sequences.erase(ob.position);
+
 			VoxelTerrain::BlockDirtyState *state = _dirty_blocks.getptr(ob.position);
 			if (state && *state == BLOCK_UPDATE_SENT) {
 				_dirty_blocks.erase(ob.position);
@@ -768,37 +1819,59 @@ void VoxelTerrain::_process() {
 				continue;
 			}
 
-			Ref<ArrayMesh> mesh;
-			mesh.instance();
+			if (_generate_meshes) {
 
-			int surface_index = 0;
-			for (int i = 0; i < ob.model_surfaces.size(); ++i) {
+				Ref<ArrayMesh> mesh;
+				mesh.instance();
 
-				Array surface = ob.model_surfaces[i];
-				if (surface.empty())
-					continue;
+				int surface_index = 0;
+				for (int i = 0; i < ob.model_surfaces.size(); ++i) {
 
-				mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, surface);
-				mesh->surface_set_material(surface_index, _materials[i]);
+					Array surface = ob.model_surfaces[i];
+					if (surface.empty())
+						continue;
 
-				++surface_index;
-			}
+					mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, surface);
+					mesh->surface_set_material(surface_index, _materials[i]);
+
+					++surface_index;
+				}
 
-			for(int i = 0; i < ob.smooth_surfaces.size(); ++i) {
+				for(int i = 0; i < ob.smooth_surfaces.size(); ++i) {
 
-				Array surface = ob.smooth_surfaces[i];
-				if (surface.empty())
-					continue;
+					Array surface = ob.smooth_surfaces[i];
+					if (surface.empty())
+						continue;
+
+					mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, surface);
+					// No material supported yet
+					++surface_index;
+				}
 
-				mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, surface);
-				// No material supported yet
-				++surface_index;
+				if (is_mesh_empty(mesh))
+					mesh = Ref<Mesh>();
+
+				block->set_mesh(mesh, world);
+				block->side_connections = ob.side_connections;
+			}
+
+			if (is_in_collision_area(ob.position)) {
+				if (ob.has_collision) {
+					block->set_collision(ob.collision_boxes, ob.collision_faces, world, get_instance_id());
+				} else {
+					// The block entered the collision area while it was being meshed
+					make_block_dirty(ob.position);
+				}
+			} else if (block->has_collision()) {
+				block->clear_collision();
 			}
 
-			if (is_mesh_empty(mesh))
-				mesh = Ref<Mesh>();
+			_latency_stats.mesh_queue.add(ob.begin_time - ob.request_time);
+			_latency_stats.meshing.add(ob.end_time - ob.begin_time);
+			_latency_stats.upload.add(os.get_ticks_usec() - apply_begin_time);
 
-			block->set_mesh(mesh, world);
+			record_edit_latency(ob.position);
+			record_load_latency(ob.position);
 		}
 
 		shift_up(_blocks_pending_main_thread_update, queue_index);
@@ -808,10 +1881,159 @@ void VoxelTerrain::_process() {
 	}
 
 	_stats.time_process_update_responses = os.get_ticks_usec() - time_before;
+	time_before = os.get_ticks_usec();
+
+	if (_cave_culling && _generate_meshes) {
+		update_cave_culling();
+	}
+
+	_stats.time_cave_culling = os.get_ticks_usec() - time_before;
+
+	update_performance_monitors();
 
 	//print_line(String("d:") + String::num(_dirty_blocks.size()) + String(", q:") + String::num(_block_update_queue.size()));
 }
 
+// A block reached while walking from the viewer
+struct _VoxelTerrainCullingStep {
+	Vector3i bpos;
+	// Side the block was entered through, or -1 for blocks where walks start
+	int entry_side;
+	// Directions taken since the start, as a mask of (1 << Cube::Side).
+	// Walks never go back in one of them, otherwise they could go around walls and reach everything.
+	uint8_t directions;
+};
+
+struct _VoxelTerrainSetCullingFrameAction {
+	uint32_t frame;
+	_VoxelTerrainSetCullingFrameAction(uint32_t p_frame) : frame(p_frame) {}
+	void operator()(VoxelBlock *block) {
+		block->culling_frame = frame;
+	}
+};
+
+struct _VoxelTerrainApplyCullingAction {
+	uint32_t frame;
+	bool visible;
+	int *culled_count;
+
+	_VoxelTerrainApplyCullingAction(uint32_t p_frame, bool p_visible, int *p_culled_count) :
+			frame(p_frame),
+			visible(p_visible),
+			culled_count(p_culled_count) {}
+
+	void operator()(VoxelBlock *block) {
+		const bool reached = block->culling_frame == frame;
+		if (!reached) {
+			++(*culled_count);
+		}
+		// Changing visibility of instances is not free
+		const bool v = visible && reached;
+		if (v != block->is_visible()) {
+			block->set_visible(v);
+		}
+	}
+};
+
+// Blocks are walked breadth-first from the viewer, going from one side of a block to another only if they can see each other.
+// This is the approach described by Tommaso Checchi for Minecraft:
+// https://tomcc.github.io/2014/08/31/visibility-1.html
+void VoxelTerrain::update_cave_culling() {
+
+	VOXEL_PROFILE_SCOPE("VoxelTerrain::update_cave_culling");
+
+	++_culling_frame;
+	const uint32_t frame = _culling_frame;
+	const int block_size = _map->get_block_size();
+
+	Vector<Vector3i> seeds;
+	Vector<Plane> frustum;
+
+	Viewport *viewport = get_viewport();
+	Camera *camera = viewport ? viewport->get_camera() : NULL;
+	if (camera) {
+		seeds.push_back(_map->voxel_to_block(camera->get_global_transform().origin));
+		frustum = camera->get_frustum();
+	} else {
+		const int *key = NULL;
+		while (key = _viewers.next(key)) {
+			const Viewer &viewer = _viewers.get(*key);
+			if (viewer.view_distance_blocks > 0) {
+				seeds.push_back(viewer.block_position);
+			}
+		}
+	}
+
+	Vector<_VoxelTerrainCullingStep> queue;
+	for (int i = 0; i < seeds.size(); ++i) {
+		VoxelBlock *block = _map->get_block(seeds[i]);
+		if (block == NULL || block->culling_frame == frame)
+			continue;
+		block->culling_frame = frame;
+		_VoxelTerrainCullingStep step;
+		step.bpos = seeds[i];
+		step.entry_side = -1;
+		step.directions = 0;
+		queue.push_back(step);
+	}
+
+	if (queue.empty()) {
+		// Viewers are outside of loaded blocks, so there is nothing to walk from. Show everything.
+		_map->for_all_blocks(_VoxelTerrainSetCullingFrameAction(frame));
+	}
+
+	// The queue is only appended to, so it is read with an index
+	for (int queue_index = 0; queue_index < queue.size(); ++queue_index) {
+
+		const _VoxelTerrainCullingStep step = queue[queue_index];
+		const VoxelBlock *block = _map->get_block(step.bpos);
+		CRASH_COND(block == NULL);
+
+		for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+
+			// Sides come in pairs
+			const unsigned int opposite_side = side ^ 1;
+
+			if (step.directions & (1 << opposite_side))
+				continue;
+
+			if (step.entry_side != -1 && !are_voxel_sides_connected(block->side_connections, step.entry_side, side))
+				continue;
+
+			const Vector3i npos = step.bpos + Cube::g_side_normals[side];
+			VoxelBlock *nblock = _map->get_block(npos);
+			if (nblock == NULL || nblock->culling_frame == frame)
+				continue;
+
+			if (!frustum.empty()) {
+				const AABB aabb(_map->block_to_voxel(npos).to_vec3(), Vector3(block_size, block_size, block_size));
+				if (!aabb.intersects_convex_shape(frustum.ptr(), frustum.size()))
+					continue;
+			}
+
+			nblock->culling_frame = frame;
+
+			_VoxelTerrainCullingStep next;
+			next.bpos = npos;
+			next.entry_side = opposite_side;
+			next.directions = step.directions | (1 << side);
+			queue.push_back(next);
+		}
+	}
+
+	// Evicted blocks stay hidden
+	for (const List<Vector3i>::Element *E = _eviction_queue.front(); E; E = E->next()) {
+		VoxelBlock *block = _map->get_block(E->get());
+		if (block) {
+			block->culling_frame = 0;
+		}
+	}
+
+	int culled_count = 0;
+	_map->for_all_blocks(_VoxelTerrainApplyCullingAction(frame, is_visible(), &culled_count));
+	_stats.culled_blocks = culled_count;
+}
+
 //void VoxelTerrain::block_removed(VoxelBlock & block) {
 //    MeshInstance * mesh_instance = block.get_mesh_instance(*this);
 //    if (mesh_instance) {
@@ -819,40 +2041,265 @@ void VoxelTerrain::_process() {
 //    }
 //}
 
-struct _VoxelTerrainRaycastContext {
-	VoxelTerrain &terrain;
-	//unsigned int channel_mask;
-};
+// Tests voxels of the map directly on their channel data, block by block.
+// Blocks that are not loaded, or only contain air, are skipped entirely.
+struct _VoxelTerrainRaycastPredicate {
+	const VoxelMap &map;
+	const VoxelLibrary &lib;
+	const uint8_t *types;
+	const uint8_t *isolevels;
+	int uniform_type;
+	int uniform_isolevel;
+	const VoxelBuffer *voxels;
+	unsigned int block_size_mask;
+
+	_VoxelTerrainRaycastPredicate(const VoxelMap &p_map, const VoxelLibrary &p_lib) :
+			map(p_map),
+			lib(p_lib),
+			types(NULL),
+			isolevels(NULL),
+			uniform_type(0),
+			uniform_isolevel(0),
+			voxels(NULL),
+			block_size_mask(p_map.get_block_size_mask()) {}
+
+	inline bool is_hit(int type, int isolevel) const {
+		if (lib.has_voxel(type) == false)
+			return false;
+		const Voxel &voxel = lib.get_voxel_const(type);
+		if (voxel.is_transparent() == false)
+			return true;
+		return isolevel - 128 >= 0;
+	}
+
+	bool enter_block(Vector3i bpos) {
+
+		const VoxelBlock *block = map.get_block(bpos);
+		if (block == NULL || block->voxels.is_null())
+			return false;
 
-static bool _raycast_binding_predicate(Vector3i pos, void *context_ptr) {
+		voxels = *block->voxels;
+		types = voxels->get_channel_raw(Voxel::CHANNEL_TYPE);
+		isolevels = voxels->get_channel_raw(Voxel::CHANNEL_ISOLEVEL);
+		uniform_type = types == NULL ? voxels->get_voxel(0, 0, 0, Voxel::CHANNEL_TYPE) : 0;
+		uniform_isolevel = isolevels == NULL ? voxels->get_voxel(0, 0, 0, Voxel::CHANNEL_ISOLEVEL) : 0;
 
-	ERR_FAIL_COND_V(context_ptr == NULL, false);
-	_VoxelTerrainRaycastContext *context = (_VoxelTerrainRaycastContext *)context_ptr;
-	VoxelTerrain &terrain = context->terrain;
+		if (types == NULL && isolevels == NULL) {
+			// The whole block is either hit or not
+			return is_hit(uniform_type, uniform_isolevel);
+		}
+		return true;
+	}
+
+	bool operator()(Vector3i pos) const {
+		const unsigned int i = voxels->index(pos.x & block_size_mask, pos.y & block_size_mask, pos.z & block_size_mask);
+		const int type = types != NULL ? types[i] : uniform_type;
+		const int isolevel = isolevels != NULL ? isolevels[i] : uniform_isolevel;
+		return is_hit(type, isolevel);
+	}
+};
 
-	//unsigned int channel = context->channel;
+void VoxelTerrain::_make_area_dirty_binding(AABB aabb) {
+	make_area_dirty(Rect3i(aabb.position, aabb.size));
+}
 
-	Ref<VoxelMap> map = terrain.get_map();
-	int v0 = map->get_voxel(pos, Voxel::CHANNEL_TYPE);
+// Finds where rays enter matter as the smooth mesher sees it: isolevels are interpolated between voxels,
+// and matter is where they are negative. The coarse traversal visits cells whose corners are voxels,
+// and the hit is then refined along the ray inside the cell.
+// Rays starting inside matter report the next surface they enter.
+struct _VoxelTerrainSmoothRaycastPredicate {
+	const VoxelMap &map;
+	const Vector3 ray_origin;
+	const Vector3 ray_direction;
+	const real_t max_distance;
+	const unsigned int block_size_pow2;
+	const unsigned int block_size_mask;
+
+	// Result
+	real_t hit_distance;
+	Vector3 hit_normal;
+
+	// Last block accessed, since neighbor voxels are most often in the same block
+	bool has_cache;
+	Vector3i cached_bpos;
+	const VoxelBuffer *voxels;
+	const uint8_t *isolevels;
+	int uniform_isolevel;
+
+	_VoxelTerrainSmoothRaycastPredicate(const VoxelMap &p_map, Vector3 p_origin, Vector3 p_direction, real_t p_max_distance) :
+			map(p_map),
+			ray_origin(p_origin),
+			ray_direction(p_direction),
+			max_distance(p_max_distance),
+			block_size_pow2(p_map.get_block_size_pow2()),
+			block_size_mask(p_map.get_block_size_mask()),
+			hit_distance(0),
+			has_cache(false),
+			voxels(NULL),
+			isolevels(NULL),
+			uniform_isolevel(0) {}
+
+	// Blocks that are not loaded count as air
+	static inline bool is_block_air(const VoxelBlock *block) {
+		if (block == NULL || block->voxels.is_null())
+			return true;
+		return block->voxels->is_uniform(Voxel::CHANNEL_ISOLEVEL) && block->voxels->get_voxel(0, 0, 0, Voxel::CHANNEL_ISOLEVEL) >= 128;
+	}
 
-	Ref<VoxelLibrary> lib_ref = terrain.get_voxel_library();
-	if (lib_ref.is_null())
+	bool enter_block(Vector3i bpos) {
+		// Cells of the block have corners in the next blocks too
+		Vector3i d;
+		for (d.z = 0; d.z < 2; ++d.z) {
+			for (d.y = 0; d.y < 2; ++d.y) {
+				for (d.x = 0; d.x < 2; ++d.x) {
+					if (!is_block_air(map.get_block(bpos + d)))
+						return true;
+				}
+			}
+		}
 		return false;
-	const VoxelLibrary &lib = **lib_ref;
+	}
+
+	int get_isolevel(const Vector3i &pos) {
+
+		const Vector3i bpos = VoxelMap::voxel_to_block_b(pos, block_size_pow2);
+
+		if (!has_cache || bpos != cached_bpos) {
+			has_cache = true;
+			cached_bpos = bpos;
+			const VoxelBlock *block = map.get_block(bpos);
+			if (block == NULL || block->voxels.is_null()) {
+				voxels = NULL;
+				isolevels = NULL;
+				uniform_isolevel = 255;
+			} else {
+				voxels = *block->voxels;
+				isolevels = voxels->get_channel_raw(Voxel::CHANNEL_ISOLEVEL);
+				uniform_isolevel = isolevels == NULL ? voxels->get_voxel(0, 0, 0, Voxel::CHANNEL_ISOLEVEL) : 0;
+			}
+		}
+
+		const int v = isolevels != NULL ?
+				isolevels[voxels->index(pos.x & block_size_mask, pos.y & block_size_mask, pos.z & block_size_mask)] :
+				uniform_isolevel;
+		return v - 128;
+	}
+
+	// Corners are ordered with X in bit 0, Y in bit 1 and Z in bit 2
+	static inline real_t interpolate(const real_t *c, Vector3 p) {
+		const real_t x00 = Math::lerp(c[0], c[1], p.x);
+		const real_t x10 = Math::lerp(c[2], c[3], p.x);
+		const real_t x01 = Math::lerp(c[4], c[5], p.x);
+		const real_t x11 = Math::lerp(c[6], c[7], p.x);
+		return Math::lerp(Math::lerp(x00, x10, p.y), Math::lerp(x01, x11, p.y), p.z);
+	}
+
+	static inline Vector3 gradient(const real_t *c, Vector3 p) {
+		const real_t gx = Math::lerp(
+				Math::lerp(c[1] - c[0], c[3] - c[2], p.y),
+				Math::lerp(c[5] - c[4], c[7] - c[6], p.y), p.z);
+		const real_t gy = Math::lerp(
+				Math::lerp(c[2] - c[0], c[3] - c[1], p.x),
+				Math::lerp(c[6] - c[4], c[7] - c[5], p.x), p.z);
+		const real_t gz = Math::lerp(
+				Math::lerp(c[4] - c[0], c[5] - c[1], p.x),
+				Math::lerp(c[6] - c[2], c[7] - c[3], p.x), p.y);
+		return Vector3(gx, gy, gz);
+	}
+
+	inline Vector3 get_local_point(Vector3 base, real_t t) const {
+		const Vector3 p = ray_origin + ray_direction * t - base;
+		return Vector3(CLAMP(p.x, 0, 1), CLAMP(p.y, 0, 1), CLAMP(p.z, 0, 1));
+	}
+
+	bool operator()(Vector3i cell) {
+
+		real_t corners[8];
+		bool has_matter = false;
+		for (int i = 0; i < 8; ++i) {
+			const int v = get_isolevel(Vector3i(cell.x + (i & 1), cell.y + ((i >> 1) & 1), cell.z + ((i >> 2) & 1)));
+			corners[i] = v;
+			has_matter |= v < 0;
+		}
+		if (!has_matter)
+			return false;
+
+		// Part of the ray inside the cell
+		real_t t0 = 0;
+		real_t t1 = max_distance;
+		for (int a = 0; a < 3; ++a) {
+			if (ray_direction[a] == 0) {
+				if (ray_origin[a] < cell[a] || ray_origin[a] > cell[a] + 1)
+					return false;
+			} else {
+				real_t ta = (cell[a] - ray_origin[a]) / ray_direction[a];
+				real_t tb = (cell[a] + 1 - ray_origin[a]) / ray_direction[a];
+				if (ta > tb)
+					SWAP(ta, tb);
+				t0 = MAX(t0, ta);
+				t1 = MIN(t1, tb);
+			}
+		}
+		if (t0 > t1)
+			return false;
+
+		// Isolevels along the ray are a cubic curve, so a few samples are enough to not miss a crossing
+		const int steps = 4;
+		const Vector3 base = cell.to_vec3();
+
+		real_t prev_t = t0;
+		real_t prev_v = interpolate(corners, get_local_point(base, t0));
+
+		for (int i = 1; i <= steps; ++i) {
+
+			real_t t = Math::lerp(t0, t1, real_t(i) / steps);
+			real_t v = interpolate(corners, get_local_point(base, t));
+
+			if (prev_v >= 0 && v < 0) {
+
+				// Narrow down the crossing
+				for (int j = 0; j < 4; ++j) {
+					const real_t mid_t = 0.5 * (prev_t + t);
+					const real_t mid_v = interpolate(corners, get_local_point(base, mid_t));
+					if (mid_v >= 0) {
+						prev_t = mid_t;
+						prev_v = mid_v;
+					} else {
+						t = mid_t;
+						v = mid_v;
+					}
+				}
+
+				hit_distance = Math::lerp(prev_t, t, prev_v / (prev_v - v));
+				// Isolevels grow towards air
+				hit_normal = gradient(corners, get_local_point(base, hit_distance)).normalized();
+				return true;
+			}
+
+			prev_t = t;
+			prev_v = v;
+		}
 
-	if (lib.has_voxel(v0) == false)
 		return false;
+	}
+};
 
-	const Voxel &voxel = lib.get_voxel_const(v0);
-	if (voxel.is_transparent() == false)
-		return true;
+bool VoxelTerrain::raycast_smooth(Vector3 origin, Vector3 direction, real_t max_distance, Vector3 &out_position, Vector3 &out_normal) const {
 
-	int v1 = map->get_voxel(pos, Voxel::CHANNEL_ISOLEVEL);
-	return v1 - 128 >= 0;
-}
+	ERR_FAIL_COND_V(direction.is_normalized() == false, false);
 
-void VoxelTerrain::_make_area_dirty_binding(AABB aabb) {
-	make_area_dirty(Rect3i(aabb.position, aabb.size));
+	_VoxelTerrainSmoothRaycastPredicate predicate(**_map, origin, direction, max_distance);
+
+	// The traversal doesn't test the cell the ray starts from, but the surface can be in it
+	Vector3i hit_cell(origin);
+	Vector3i prev_cell;
+	if (predicate(hit_cell) || voxel_raycast_hierarchical(origin, direction, _map->get_block_size_pow2(), predicate, max_distance, hit_cell, prev_cell)) {
+		out_position = origin + direction * predicate.hit_distance;
+		out_normal = predicate.hit_normal;
+		return true;
+	}
+
+	return false;
 }
 
 Variant VoxelTerrain::_raycast_binding(Vector3 origin, Vector3 direction, real_t max_distance) {
@@ -862,9 +2309,12 @@ Variant VoxelTerrain::_raycast_binding(Vector3 origin, Vector3 direction, real_t
 	Vector3i hit_pos;
 	Vector3i prev_pos;
 
-	_VoxelTerrainRaycastContext context = { *this };
+	if (_library.is_null())
+		return Variant();
+
+	_VoxelTerrainRaycastPredicate predicate(**_map, **_library);
 
-	if (voxel_raycast(origin, direction, _raycast_binding_predicate, &context, max_distance, hit_pos, prev_pos)) {
+	if (voxel_raycast_hierarchical(origin, direction, _map->get_block_size_pow2(), predicate, max_distance, hit_pos, prev_pos)) {
 
 		Dictionary hit = Dictionary();
 		hit["position"] = hit_pos.to_vec3();
@@ -875,6 +2325,162 @@ Variant VoxelTerrain::_raycast_binding(Vector3 origin, Vector3 direction, real_t
 	}
 }
 
+Variant VoxelTerrain::_raycast_smooth_binding(Vector3 origin, Vector3 direction, real_t max_distance) {
+
+	Vector3 position;
+	Vector3 normal;
+
+	if (raycast_smooth(origin, direction, max_distance, position, normal)) {
+
+		Dictionary hit = Dictionary();
+		hit["position"] = position;
+		hit["normal"] = normal;
+		hit["distance"] = origin.distance_to(position);
+		return hit;
+	} else {
+		return Variant();
+	}
+}
+
+// Rays given to one worker thread
+struct _VoxelTerrainRaycastBatchJob {
+	const VoxelMap *map;
+	const VoxelLibrary *lib;
+	const Vector3 *origins;
+	const Vector3 *directions;
+	real_t max_distance;
+	bool smooth;
+	Vector3 *out_hit_positions;
+	Vector3 *out_hit_normals;
+	uint8_t *out_hits;
+	int begin;
+	int end;
+	int hit_count;
+
+	void run() {
+		const unsigned int block_size_pow2 = map->get_block_size_pow2();
+		hit_count = 0;
+
+		for (int i = begin; i < end; ++i) {
+
+			out_hits[i] = 0;
+			out_hit_positions[i] = Vector3();
+			out_hit_normals[i] = Vector3();
+
+			if (directions[i] == Vector3())
+				continue;
+
+			const Vector3 origin = origins[i];
+			const Vector3 direction = directions[i].normalized();
+
+			if (smooth) {
+				_VoxelTerrainSmoothRaycastPredicate predicate(*map, origin, direction, max_distance);
+				Vector3i hit_cell(origin);
+				Vector3i prev_cell;
+				if (predicate(hit_cell) || voxel_raycast_hierarchical(origin, direction, block_size_pow2, predicate, max_distance, hit_cell, prev_cell)) {
+					out_hits[i] = 1;
+					out_hit_positions[i] = origin + direction * predicate.hit_distance;
+					out_hit_normals[i] = predicate.hit_normal;
+					++hit_count;
+				}
+
+			} else {
+				_VoxelTerrainRaycastPredicate predicate(*map, *lib);
+				Vector3i hit_pos;
+				Vector3i prev_pos;
+				if (voxel_raycast_hierarchical(origin, direction, block_size_pow2, predicate, max_distance, hit_pos, prev_pos)) {
+					out_hits[i] = 1;
+					out_hit_positions[i] = hit_pos.to_vec3();
+					out_hit_normals[i] = (prev_pos - hit_pos).to_vec3();
+					++hit_count;
+				}
+			}
+		}
+	}
+
+	static void run_job(void *p_jobs, int job_index) {
+		reinterpret_cast<_VoxelTerrainRaycastBatchJob *>(p_jobs)[job_index].run();
+	}
+};
+
+int VoxelTerrain::raycast_batch(const Vector3 *origins, const Vector3 *directions, int count, real_t max_distance,
+		Vector3 *out_hit_positions, Vector3 *out_hit_normals, uint8_t *out_hits, bool smooth) const {
+
+	ERR_FAIL_COND_V(count < 0, 0);
+	if (count == 0 || (_library.is_null() && !smooth))
+		return 0;
+
+	VoxelJobPool *pool = VoxelJobPool::get_singleton();
+	ERR_FAIL_COND_V(pool == NULL, 0);
+
+	// Below that, handing rays to another thread costs more than it saves
+	const int min_rays_per_job = 256;
+	const int max_jobs = VoxelJobPool::MAX_WORKERS + 1;
+
+	int job_count = MIN(pool->get_concurrency(), count / min_rays_per_job);
+	if (job_count < 1)
+		job_count = 1;
+
+	_VoxelTerrainRaycastBatchJob jobs[max_jobs];
+
+	const int rays_per_job = count / job_count;
+
+	for (int i = 0; i < job_count; ++i) {
+		_VoxelTerrainRaycastBatchJob &job = jobs[i];
+		job.map = *_map;
+		job.lib = _library.is_valid() ? *_library : NULL;
+		job.origins = origins;
+		job.directions = directions;
+		job.max_distance = max_distance;
+		job.smooth = smooth;
+		job.out_hit_positions = out_hit_positions;
+		job.out_hit_normals = out_hit_normals;
+		job.out_hits = out_hits;
+		job.begin = i * rays_per_job;
+		job.end = i + 1 == job_count ? count : job.begin + rays_per_job;
+		job.hit_count = 0;
+	}
+
+	// Workers only read the map, which is safe as long as nothing writes to it meanwhile
+	pool->run(_VoxelTerrainRaycastBatchJob::run_job, jobs, job_count);
+
+	int hit_count = 0;
+	for (int i = 0; i < job_count; ++i)
+		hit_count += jobs[i].hit_count;
+
+	return hit_count;
+}
+
+Dictionary VoxelTerrain::_raycast_batch_binding(PoolVector3Array origins, PoolVector3Array directions, real_t max_distance, bool smooth) {
+
+	ERR_FAIL_COND_V(origins.size() != directions.size(), Dictionary());
+	const int count = origins.size();
+
+	PoolVector3Array hit_positions;
+	PoolVector3Array hit_normals;
+	PoolByteArray hits;
+	hit_positions.resize(count);
+	hit_normals.resize(count);
+	hits.resize(count);
+
+	{
+		PoolVector3Array::Read origins_read = origins.read();
+		PoolVector3Array::Read directions_read = directions.read();
+		PoolVector3Array::Write positions_write = hit_positions.write();
+		PoolVector3Array::Write normals_write = hit_normals.write();
+		PoolByteArray::Write hits_write = hits.write();
+
+		raycast_batch(origins_read.ptr(), directions_read.ptr(), count, max_distance,
+				positions_write.ptr(), normals_write.ptr(), hits_write.ptr(), smooth);
+	}
+
+	Dictionary d;
+	d["hits"] = hits;
+	d["positions"] = hit_positions;
+	d["normals"] = hit_normals;
+	return d;
+}
+
 Vector3 VoxelTerrain::_voxel_to_block_binding(Vector3 pos) {
 	return Vector3i(_map->voxel_to_block(pos)).to_vec3();
 }
@@ -907,12 +2513,49 @@ void VoxelTerrain::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_view_distance", "distance_in_voxels"), &VoxelTerrain::set_view_distance);
 	ClassDB::bind_method(D_METHOD("get_view_distance"), &VoxelTerrain::get_view_distance);
 
+	ClassDB::bind_method(D_METHOD("set_unload_margin", "distance_in_voxels"), &VoxelTerrain::set_unload_margin);
+	ClassDB::bind_method(D_METHOD("get_unload_margin"), &VoxelTerrain::get_unload_margin);
+
+	ClassDB::bind_method(D_METHOD("set_eviction_memory_budget", "bytes"), &VoxelTerrain::set_eviction_memory_budget);
+	ClassDB::bind_method(D_METHOD("get_eviction_memory_budget"), &VoxelTerrain::get_eviction_memory_budget);
+
+	ClassDB::bind_method(D_METHOD("set_view_shape", "shape"), &VoxelTerrain::set_view_shape);
+	ClassDB::bind_method(D_METHOD("get_view_shape"), &VoxelTerrain::get_view_shape);
+
+	ClassDB::bind_method(D_METHOD("set_view_distance_up", "distance_in_voxels"), &VoxelTerrain::set_view_distance_up);
+	ClassDB::bind_method(D_METHOD("get_view_distance_up"), &VoxelTerrain::get_view_distance_up);
+
+	ClassDB::bind_method(D_METHOD("set_view_distance_down", "distance_in_voxels"), &VoxelTerrain::set_view_distance_down);
+	ClassDB::bind_method(D_METHOD("get_view_distance_down"), &VoxelTerrain::get_view_distance_down);
+
 	ClassDB::bind_method(D_METHOD("get_generate_collisions"), &VoxelTerrain::get_generate_collisions);
 	ClassDB::bind_method(D_METHOD("set_generate_collisions", "enabled"), &VoxelTerrain::set_generate_collisions);
 
+	ClassDB::bind_method(D_METHOD("get_generate_meshes"), &VoxelTerrain::get_generate_meshes);
+	ClassDB::bind_method(D_METHOD("set_generate_meshes", "enabled"), &VoxelTerrain::set_generate_meshes);
+
+	ClassDB::bind_method(D_METHOD("get_collision_distance"), &VoxelTerrain::get_collision_distance);
+	ClassDB::bind_method(D_METHOD("set_collision_distance", "distance_in_voxels"), &VoxelTerrain::set_collision_distance);
+
+	ClassDB::bind_method(D_METHOD("get_cave_culling"), &VoxelTerrain::get_cave_culling);
+	ClassDB::bind_method(D_METHOD("set_cave_culling", "enabled"), &VoxelTerrain::set_cave_culling);
+
+	ClassDB::bind_method(D_METHOD("get_prefetch_lookahead_time"), &VoxelTerrain::get_prefetch_lookahead_time);
+	ClassDB::bind_method(D_METHOD("set_prefetch_lookahead_time", "seconds"), &VoxelTerrain::set_prefetch_lookahead_time);
+
+	ClassDB::bind_method(D_METHOD("get_prefetch_direction_weight"), &VoxelTerrain::get_prefetch_direction_weight);
+	ClassDB::bind_method(D_METHOD("set_prefetch_direction_weight", "weight"), &VoxelTerrain::set_prefetch_direction_weight);
+
 	ClassDB::bind_method(D_METHOD("get_viewer_path"), &VoxelTerrain::get_viewer_path);
 	ClassDB::bind_method(D_METHOD("set_viewer_path", "path"), &VoxelTerrain::set_viewer_path);
 
+	ClassDB::bind_method(D_METHOD("add_viewer", "position", "view_distance_in_voxels"), &VoxelTerrain::add_viewer);
+	ClassDB::bind_method(D_METHOD("remove_viewer", "id"), &VoxelTerrain::remove_viewer);
+	ClassDB::bind_method(D_METHOD("set_viewer_position", "id", "position"), &VoxelTerrain::set_viewer_position);
+	ClassDB::bind_method(D_METHOD("get_viewer_position", "id"), &VoxelTerrain::get_viewer_position);
+	ClassDB::bind_method(D_METHOD("set_viewer_view_distance", "id", "distance_in_voxels"), &VoxelTerrain::set_viewer_view_distance);
+	ClassDB::bind_method(D_METHOD("get_viewer_view_distance", "id"), &VoxelTerrain::get_viewer_view_distance);
+
 	ClassDB::bind_method(D_METHOD("get_storage"), &VoxelTerrain::get_map);
 
 	ClassDB::bind_method(D_METHOD("voxel_to_block", "voxel_pos"), &VoxelTerrain::_voxel_to_block_binding);
@@ -921,20 +2564,51 @@ void VoxelTerrain::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("make_voxel_dirty", "pos"), &VoxelTerrain::_make_voxel_dirty_binding);
 	ClassDB::bind_method(D_METHOD("make_area_dirty", "aabb"), &VoxelTerrain::_make_area_dirty_binding);
 
+	ClassDB::bind_method(D_METHOD("get_low_latency_edit_distance"), &VoxelTerrain::get_low_latency_edit_distance);
+	ClassDB::bind_method(D_METHOD("set_low_latency_edit_distance", "distance_in_voxels"), &VoxelTerrain::set_low_latency_edit_distance);
+
+	ClassDB::bind_method(D_METHOD("begin_edit"), &VoxelTerrain::begin_edit);
+	ClassDB::bind_method(D_METHOD("end_edit"), &VoxelTerrain::end_edit);
+
+	ClassDB::bind_method(D_METHOD("do_sphere", "center", "radius", "value", "channel"), &VoxelTerrain::do_sphere, DEFVAL(Voxel::CHANNEL_TYPE));
+	ClassDB::bind_method(D_METHOD("do_box", "begin", "end", "value", "channel"), &VoxelTerrain::_do_box_binding, DEFVAL(Voxel::CHANNEL_TYPE));
+
 	ClassDB::bind_method(D_METHOD("raycast", "origin", "direction", "max_distance"), &VoxelTerrain::_raycast_binding, DEFVAL(100));
+	ClassDB::bind_method(D_METHOD("raycast_smooth", "origin", "direction", "max_distance"), &VoxelTerrain::_raycast_smooth_binding, DEFVAL(100));
+	ClassDB::bind_method(D_METHOD("raycast_batch", "origins", "directions", "max_distance", "smooth"), &VoxelTerrain::_raycast_batch_binding, DEFVAL(100), DEFVAL(false));
 
 	ClassDB::bind_method(D_METHOD("get_statistics"), &VoxelTerrain::get_statistics);
+	ClassDB::bind_method(D_METHOD("get_latency_statistics"), &VoxelTerrain::get_latency_statistics);
+	ClassDB::bind_method(D_METHOD("reset_latency_statistics"), &VoxelTerrain::reset_latency_statistics);
+#ifdef VOXEL_PROFILING
+	ClassDB::bind_method(D_METHOD("save_profiling_trace", "path"), &VoxelTerrain::save_profiling_trace);
+#endif
 	ClassDB::bind_method(D_METHOD("get_block_state", "block_pos"), &VoxelTerrain::get_block_state);
 
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "provider", PROPERTY_HINT_RESOURCE_TYPE, "VoxelProvider"), "set_provider", "get_provider");
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "voxel_library", PROPERTY_HINT_RESOURCE_TYPE, "VoxelLibrary"), "set_voxel_library", "get_voxel_library");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "view_distance"), "set_view_distance", "get_view_distance");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "unload_margin"), "set_unload_margin", "get_unload_margin");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "eviction_memory_budget"), "set_eviction_memory_budget", "get_eviction_memory_budget");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "view_shape", PROPERTY_HINT_ENUM, "Box,Sphere,Cylinder"), "set_view_shape", "get_view_shape");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "view_distance_up"), "set_view_distance_up", "get_view_distance_up");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "view_distance_down"), "set_view_distance_down", "get_view_distance_down");
 	ADD_PROPERTY(PropertyInfo(Variant::NODE_PATH, "viewer_path"), "set_viewer_path", "get_viewer_path");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "generate_collisions"), "set_generate_collisions", "get_generate_collisions");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "generate_meshes"), "set_generate_meshes", "get_generate_meshes");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "collision_distance"), "set_collision_distance", "get_collision_distance");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "cave_culling"), "set_cave_culling", "get_cave_culling");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "low_latency_edit_distance"), "set_low_latency_edit_distance", "get_low_latency_edit_distance");
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "prefetch_lookahead_time"), "set_prefetch_lookahead_time", "get_prefetch_lookahead_time");
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "prefetch_direction_weight", PROPERTY_HINT_RANGE, "0,0.99,0.01"), "set_prefetch_direction_weight", "get_prefetch_direction_weight");
 
 	BIND_ENUM_CONSTANT(BLOCK_NONE);
 	BIND_ENUM_CONSTANT(BLOCK_LOAD);
 	BIND_ENUM_CONSTANT(BLOCK_UPDATE_NOT_SENT);
 	BIND_ENUM_CONSTANT(BLOCK_UPDATE_SENT);
 	BIND_ENUM_CONSTANT(BLOCK_IDLE);
+
+	BIND_ENUM_CONSTANT(VIEW_SHAPE_BOX);
+	BIND_ENUM_CONSTANT(VIEW_SHAPE_SPHERE);
+	BIND_ENUM_CONSTANT(VIEW_SHAPE_CYLINDER);
 }
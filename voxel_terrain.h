@@ -7,10 +7,13 @@
 #include "voxel_provider_thread.h"
 #include "voxel_mesh_updater.h"
 #include "rect3i.h"
+#include "voxel_view_region.h"
+#include "voxel_map.h"
+#include "voxel_latency_histogram.h"
 
+#include <core/list.h>
 #include <scene/3d/spatial.h>
 
-class VoxelMap;
 class VoxelLibrary;
 
 // Infinite static terrain made of voxels.
@@ -27,6 +30,12 @@ public:
 		BLOCK_IDLE
 	};
 
+	enum ViewShape {
+		VIEW_SHAPE_BOX = VoxelViewRegion::SHAPE_BOX,
+		VIEW_SHAPE_SPHERE = VoxelViewRegion::SHAPE_SPHERE,
+		VIEW_SHAPE_CYLINDER = VoxelViewRegion::SHAPE_CYLINDER
+	};
+
 	VoxelTerrain();
 	~VoxelTerrain();
 
@@ -42,15 +51,102 @@ public:
 	void make_area_dirty(Rect3i box);
 	bool is_block_dirty(Vector3i bpos) const;
 
+	// Blocks edited this close to a viewer skip the update queue, so edits show up with less latency.
+	// Zero disables it.
+	int get_low_latency_edit_distance() const;
+	void set_low_latency_edit_distance(int distance_in_voxels);
+
+	// Edits made between these calls only schedule block updates when the outermost end_edit() is called,
+	// so each affected block gets updated once no matter how many voxels changed.
+	void begin_edit();
+	void end_edit();
+
+	// Edits voxels inside a shape, given in voxel coordinates. Only loaded blocks are modified.
+	// On the isolevel channel, a non-zero value adds matter and zero removes it,
+	// blending with the existing surface so smooth terrain stays smooth.
+	// On other channels, voxels inside the shape are set to the value.
+	void do_sphere(Vector3 center, real_t radius, int value, unsigned int channel = Voxel::CHANNEL_TYPE);
+	void do_box(Vector3i begin, Vector3i end, int value, unsigned int channel = Voxel::CHANNEL_TYPE);
+
+	// Same as above with any shape. `sdf` returns the signed distance from a voxel position to the shape,
+	// negative inside. Only voxels within `box` are visited.
+	template <typename Sdf_F>
+	void do_sdf_op(Rect3i box, Sdf_F sdf, int value, unsigned int channel);
+
+	// Casts a ray against the smooth surface described by the isolevel channel.
+	// The hit point is interpolated between voxels, and the normal is the gradient of isolevels there.
+	bool raycast_smooth(Vector3 origin, Vector3 direction, real_t max_distance, Vector3 &out_position, Vector3 &out_normal) const;
+
+	// Casts many rays at once, spread over the threads of VoxelJobPool. Directions don't need to be normalized.
+	// For each ray, `out_hits` tells if it hit a voxel, in which case the voxel position and the normal
+	// of the face it entered through are written. In smooth mode, hits are found like raycast_smooth.
+	// Returns the number of hits. The map must not be modified until it returns.
+	// Batches from several threads run one after the other.
+	int raycast_batch(const Vector3 *origins, const Vector3 *directions, int count, real_t max_distance,
+			Vector3 *out_hit_positions, Vector3 *out_hit_normals, uint8_t *out_hits, bool smooth = false) const;
+
 	void set_generate_collisions(bool enabled);
 	bool get_generate_collisions() const { return _generate_collisions; }
 
+	// When disabled, the terrain only streams voxel data and collisions, which suits dedicated servers.
+	// No meshes nor visual instances are created, and meshing only runs if collisions are needed.
+	void set_generate_meshes(bool enabled);
+	bool get_generate_meshes() const { return _generate_meshes; }
+
+	int get_collision_distance() const;
+	void set_collision_distance(int distance_in_voxels);
+
+	// Hides blocks the camera can't see, like caves underground. Every frame, blocks are walked from the one
+	// containing the camera, through sides they can be seen through and within the camera frustum.
+	// Only cubic voxels hide blocks. Without a camera, walks start from viewers and ignore the frustum.
+	void set_cave_culling(bool enabled);
+	bool get_cave_culling() const { return _cave_culling; }
+
 	int get_view_distance() const;
 	void set_view_distance(int distance_in_voxels);
 
+	// Blocks are kept loaded this much further than the view distance,
+	// so viewers moving back and forth across a block boundary don't reload the same blocks
+	int get_unload_margin() const;
+	void set_unload_margin(int distance_in_voxels);
+
+	// Unloaded blocks are kept hidden in a cache until they take more than this amount of bytes,
+	// so they can be shown again without being regenerated.
+	// Each block counts its voxel data, its mesh and a fixed cost, so uniform blocks count too.
+	int get_eviction_memory_budget() const { return _eviction_memory_budget; }
+	void set_eviction_memory_budget(int bytes);
+
+	ViewShape get_view_shape() const { return _view_shape; }
+	void set_view_shape(ViewShape shape);
+
+	// Vertical extents of box and cylinder view shapes.
+	// Negative values use the view distance.
+	int get_view_distance_up() const;
+	void set_view_distance_up(int distance_in_voxels);
+	int get_view_distance_down() const;
+	void set_view_distance_down(int distance_in_voxels);
+
+	// Blocks are loaded first around where viewers are expected to be after this time, in seconds
+	float get_prefetch_lookahead_time() const { return _prefetch_lookahead_time; }
+	void set_prefetch_lookahead_time(float seconds);
+
+	// How much blocks in front of viewers are preferred over blocks behind them, in [0, 1[.
+	// The node viewer uses the direction it faces, others use the direction they move to.
+	float get_prefetch_direction_weight() const { return _prefetch_direction_weight; }
+	void set_prefetch_direction_weight(float weight);
+
 	void set_viewer_path(NodePath path);
 	NodePath get_viewer_path() const;
 
+	// Additional viewers, for example players of a multiplayer server.
+	// Blocks are loaded around all viewers, and those closest to any viewer are loaded first.
+	int add_viewer(Vector3 position, int view_distance_in_voxels);
+	void remove_viewer(int id);
+	void set_viewer_position(int id, Vector3 position);
+	Vector3 get_viewer_position(int id) const;
+	void set_viewer_view_distance(int id, int distance_in_voxels);
+	int get_viewer_view_distance(int id) const;
+
 	void set_material(int id, Ref<Material> material);
 	Ref<Material> get_material(int id) const;
 
@@ -64,11 +160,19 @@ public:
 		int dropped_provider_blocks;
 		int dropped_updater_blocks;
 		int remaining_main_thread_blocks;
+		// Meshers not run because block summaries showed they would produce nothing
+		int skipped_model_meshes;
+		int skipped_smooth_meshes;
+		int culled_blocks;
 		uint64_t time_detect_required_blocks;
 		uint64_t time_send_load_requests;
 		uint64_t time_process_load_responses;
 		uint64_t time_send_update_requests;
 		uint64_t time_process_update_responses;
+		uint64_t time_cave_culling;
+		// Time between an edit and when its block shows up, in microseconds
+		uint64_t last_edit_latency;
+		uint64_t max_edit_latency;
 
 		Stats():
 			mesh_alloc_time(0),
@@ -76,11 +180,17 @@ public:
 			dropped_provider_blocks(0),
 			dropped_updater_blocks(0),
 			remaining_main_thread_blocks(0),
+			skipped_model_meshes(0),
+			skipped_smooth_meshes(0),
+			culled_blocks(0),
 			time_detect_required_blocks(0),
 			time_send_load_requests(0),
 			time_process_load_responses(0),
 			time_send_update_requests(0),
-			time_process_update_responses(0)
+			time_process_update_responses(0),
+			time_cave_culling(0),
+			last_edit_latency(0),
+			max_edit_latency(0)
 		{ }
 	};
 
@@ -92,16 +202,77 @@ private:
 	bool _get(const StringName &p_name, Variant &r_ret) const;
 	void _get_property_list(List<PropertyInfo> *p_list) const;
 
+	struct Viewer {
+		Vector3 position;
+		Vector3 prev_position;
+		// Smoothed, in voxels per second
+		Vector3 velocity;
+		// Normalized, or zero if unknown
+		Vector3 direction;
+		Vector3i block_position;
+		int view_distance_blocks;
+		// Blocks currently loaded by the viewer
+		VoxelViewRegion region;
+		// Blocks the viewer prevents from being unloaded. Contains the load region.
+		VoxelViewRegion retain_region;
+		Rect3i collision_box;
+
+		Viewer() : view_distance_blocks(0) {}
+	};
+
 	void _process();
 
 	void make_all_view_dirty_deferred();
+	void update_block_updater();
+	void resend_requests(BlockDirtyState sent_state);
+
+	void update_viewer_motion(Viewer &viewer, float delta);
+	Vector3i get_predicted_block_position(const Viewer &viewer) const;
 
 	Spatial *get_viewer(NodePath path) const;
 
+	VoxelViewRegion get_view_region(Vector3i center, int view_distance_blocks, int margin_blocks) const;
+	void set_viewer_region(Viewer &viewer, const VoxelViewRegion &new_region, const VoxelViewRegion &new_retain_region);
+	void set_viewer_collision_box(Viewer &viewer, Rect3i new_box);
+	bool is_in_collision_area(Vector3i bpos) const;
+	void ref_block(Vector3i bpos);
+	void unref_block(Vector3i bpos);
+	void retain_block(Vector3i bpos);
+	void release_block(Vector3i bpos);
+	void for_each_block(const Vector<Rect3i> &boxes, void (VoxelTerrain::*action)(Vector3i));
+	void add_collision_area(Rect3i box);
+	void remove_collision_area(Rect3i box);
+
+	void evict_block(Vector3i bpos);
+	bool revive_block(Vector3i bpos);
+	void trim_eviction_queue(size_t max_memory);
 	void immerge_block(Vector3i bpos);
 
+	void make_edited_block_dirty(Vector3i bpos);
+
+	void update_cave_culling();
+	void reset_block_visibility();
+	bool is_in_low_latency_area(Vector3i bpos) const;
+	void record_edit_latency(Vector3i bpos);
+	void record_load_latency(Vector3i bpos);
+
+	static void report_pending_count(int monitor, int count, int &reported_count);
+	void update_performance_monitors();
+	void add_edited_area(Rect3i voxel_box);
+	void commit_edit();
+
 	Dictionary get_statistics() const;
 
+	// Durations of each stage blocks go through, from their load request to when they are shown.
+	// Percentiles are computed over everything recorded since the last reset.
+	Dictionary get_latency_statistics() const;
+	void reset_latency_statistics();
+
+#ifdef VOXEL_PROFILING
+	// Saves a timeline of the latest work done by the terrain and its threads, see ZProfiler::save_chrome_trace()
+	Error save_profiling_trace(String path);
+#endif
+
 	static void _bind_methods();
 
 	// Convenience
@@ -110,13 +281,14 @@ private:
 	//void _force_load_blocks_binding(Vector3 center, Vector3 extents) { force_load_blocks(center, extents); }
 	void _make_voxel_dirty_binding(Vector3 pos) { make_voxel_dirty(pos); }
 	void _make_area_dirty_binding(AABB aabb);
+	void _do_box_binding(Vector3 begin, Vector3 end, int value, unsigned int channel) { do_box(begin, end, value, channel); }
 	Variant _raycast_binding(Vector3 origin, Vector3 direction, real_t max_distance);
+	Variant _raycast_smooth_binding(Vector3 origin, Vector3 direction, real_t max_distance);
+	Dictionary _raycast_batch_binding(PoolVector3Array origins, PoolVector3Array directions, real_t max_distance, bool smooth);
 	void set_voxel(Vector3 pos, int value, int c);
 	int get_voxel(Vector3 pos, int c);
 	BlockDirtyState get_block_state(Vector3 p_bpos) const;
 
-	static void remove_positions_outside_box(Vector<Vector3i> &positions, Rect3i box, HashMap<Vector3i, BlockDirtyState, Vector3iHasher> &state_map);
-
 private:
 	// Voxel storage
 	Ref<VoxelMap> _map;
@@ -124,6 +296,35 @@ private:
 	// How many blocks to load around the viewer
 	int _view_distance_blocks;
 
+	ViewShape _view_shape;
+	int _view_distance_up_blocks;
+	int _view_distance_down_blocks;
+
+	// The viewer driven by the node path is always registered with this ID
+	static const int DEFAULT_VIEWER_ID = 0;
+
+	HashMap<int, Viewer> _viewers;
+	int _next_viewer_id;
+
+	// How many viewers need each block to be loaded
+	HashMap<Vector3i, int, Vector3iHasher> _block_refcounts;
+	// How many viewers prevent each block from being unloaded. Blocks not in this map are evicted.
+	HashMap<Vector3i, int, Vector3iHasher> _block_retain_refcounts;
+
+	struct EvictedBlock {
+		List<Vector3i>::Element *element;
+		size_t memory;
+		// The mesh is outdated, and will be updated if the block is revived
+		bool needs_update;
+	};
+
+	// Evicted blocks, least recently evicted first
+	List<Vector3i> _eviction_queue;
+	HashMap<Vector3i, EvictedBlock, Vector3iHasher> _evicted_blocks;
+	size_t _eviction_queue_memory;
+	int _eviction_memory_budget;
+	int _unload_margin_blocks;
+
 	// TODO Terrains only need to handle the visible portion of voxels, which reduces the bounds blocks to handle.
 	// Therefore, could a simple grid be better to use than a hashmap?
 
@@ -131,6 +332,41 @@ private:
 	Vector<Vector3i> _blocks_pending_update;
 	HashMap<Vector3i, BlockDirtyState, Vector3iHasher> _dirty_blocks; // TODO Rename _block_states
 	Vector<VoxelMeshUpdater::OutputBlock> _blocks_pending_main_thread_update;
+	// Latest update sent for blocks whose result hasn't been applied yet.
+	// Results can arrive out of order, so older ones are dropped.
+	HashMap<Vector3i, uint32_t, Vector3iHasher> _block_update_sequences;
+	uint32_t _next_update_sequence;
+
+	// Edit transaction
+	int _edit_depth;
+	HashMap<Vector3i, bool, Vector3iHasher> _edited_blocks;
+	Rect3i _edited_voxels;
+
+	// When blocks were edited, until they get updated
+	HashMap<Vector3i, uint64_t, Vector3iHasher> _block_edit_times;
+	// When blocks were requested to load, until they are shown
+	HashMap<Vector3i, uint64_t, Vector3iHasher> _block_load_times;
+
+	// All in microseconds
+	struct LatencyStats {
+		// From load request to when the provider starts generating
+		VoxelLatencyHistogram load_queue;
+		VoxelLatencyHistogram generation;
+		// From mesh request to when the updater starts meshing
+		VoxelLatencyHistogram mesh_queue;
+		VoxelLatencyHistogram meshing;
+		// Creating and assigning meshes and collisions on the main thread
+		VoxelLatencyHistogram upload;
+		// From load request to when the block is shown
+		VoxelLatencyHistogram total;
+	};
+	LatencyStats _latency_stats;
+
+	// What this terrain added to global performance counters
+	int _reported_pending_loads;
+	int _reported_pending_meshes;
+	int _reported_pending_main_thread_blocks;
+	int _low_latency_edit_distance_blocks;
 
 	Ref<VoxelProvider> _provider;
 	VoxelProviderThread *_provider_thread;
@@ -139,17 +375,109 @@ private:
 	VoxelMeshUpdater *_block_updater;
 
 	NodePath _viewer_path;
-	Vector3i _last_viewer_block_pos;
-	int _last_view_distance_blocks;
+	bool _all_view_dirty;
+
+	float _prefetch_lookahead_time;
+	float _prefetch_direction_weight;
 
 	bool _generate_collisions;
+	bool _generate_meshes;
 	bool _run_in_editor;
 
+	bool _cave_culling;
+	// Incremented each time culling runs, so blocks can tell if they were reached in the current run
+	uint32_t _culling_frame;
+
+	// How many blocks around the viewer get collision shapes.
+	// Usually smaller than the view distance, because physics only matters close to the viewer.
+	int _collision_distance_blocks;
+
 	Ref<Material> _materials[VoxelMesher::MAX_MATERIALS];
 
 	Stats _stats;
 };
 
+template <typename Sdf_F>
+void VoxelTerrain::do_sdf_op(Rect3i box, Sdf_F sdf, int value, unsigned int channel) {
+
+	ERR_FAIL_COND(channel >= VoxelBuffer::MAX_CHANNELS);
+	if (box.is_empty())
+		return;
+
+	// Isolevels have 128 steps per unit, so one voxel of distance spans about 12 steps
+	const float sdf_scale = 0.1f;
+	const bool smooth = channel == Voxel::CHANNEL_ISOLEVEL;
+	const bool add = value != 0;
+
+	const Vector3i box_end = box.pos + box.size;
+	const Vector3i min_bpos = _map->voxel_to_block(box.pos);
+	const Vector3i max_bpos = _map->voxel_to_block(box_end - Vector3i(1, 1, 1));
+	const Vector3i block_size(_map->get_block_size());
+
+	// Work block by block, so each block is looked up once and voxels are accessed directly
+	Vector3i bpos;
+	for (bpos.z = min_bpos.z; bpos.z <= max_bpos.z; ++bpos.z) {
+		for (bpos.x = min_bpos.x; bpos.x <= max_bpos.x; ++bpos.x) {
+			for (bpos.y = min_bpos.y; bpos.y <= max_bpos.y; ++bpos.y) {
+
+				VoxelBlock *block = _map->get_block(bpos);
+				if (block == NULL)
+					continue;
+
+				VoxelBuffer &buffer = **block->voxels;
+
+				if (!smooth && buffer.get_channel_raw(channel) == NULL && buffer.get_voxel(0, 0, 0, channel) == value) {
+					// Already filled with the value
+					continue;
+				}
+
+				buffer.decompress_channel(channel);
+				uint8_t *data = buffer.get_channel_raw(channel);
+
+				// Part of the box inside the block
+				const Vector3i origin = _map->block_to_voxel(bpos);
+				Vector3i min = box.pos - origin;
+				Vector3i max = box_end - origin;
+				min.clamp_to(Vector3i(0, 0, 0), block_size);
+				max.clamp_to(Vector3i(0, 0, 0), block_size + Vector3i(1, 1, 1));
+
+				Vector3i pos;
+				for (pos.z = min.z; pos.z < max.z; ++pos.z) {
+					for (pos.x = min.x; pos.x < max.x; ++pos.x) {
+
+						// Rows are along Y
+						uint8_t *row = data + buffer.index(pos.x, 0, pos.z);
+
+						for (pos.y = min.y; pos.y < max.y; ++pos.y) {
+
+							const float d = sdf((origin + pos).to_vec3());
+							uint8_t &v = row[pos.y];
+
+							if (smooth) {
+								// Negative isolevels are solid, so union and subtraction are min and max
+								if (add) {
+									v = MIN(v, VoxelBuffer::iso_to_byte(d * sdf_scale));
+								} else {
+									v = MAX(v, VoxelBuffer::iso_to_byte(-d * sdf_scale));
+								}
+							} else if (d <= 0) {
+								v = value;
+							}
+						}
+					}
+				}
+
+				// Voxels were written directly
+				buffer.compute_summary();
+			}
+		}
+	}
+
+	// Each block touched by the box, and neighbors sharing its border voxels, are updated once
+	make_area_dirty(box);
+}
+
 VARIANT_ENUM_CAST(VoxelTerrain::BlockDirtyState)
+VARIANT_ENUM_CAST(VoxelTerrain::ViewShape)
 
 #endif // VOXEL_TERRAIN_H
@@ -0,0 +1,131 @@
+#include "voxel_view_region.h"
+#include <core/math/math_funcs.h>
+
+// Largest integer whose square is lower or equal to `x`
+static int isqrt(int x) {
+	int r = int(Math::sqrt(double(x)));
+	// Correct floating point rounding
+	while (r * r > x)
+		--r;
+	while ((r + 1) * (r + 1) <= x)
+		++r;
+	return r;
+}
+
+Rect3i VoxelViewRegion::get_bounds() const {
+
+	switch (shape) {
+
+		case SHAPE_BOX:
+			return Rect3i(
+					Vector3i(center.x - radius, center.y - down, center.z - radius),
+					Vector3i(2 * radius, up + down, 2 * radius));
+
+		case SHAPE_SPHERE:
+			return Rect3i(center - Vector3i(radius), Vector3i(2 * radius + 1));
+
+		case SHAPE_CYLINDER:
+			return Rect3i(
+					Vector3i(center.x - radius, center.y - down, center.z - radius),
+					Vector3i(2 * radius + 1, up + down + 1, 2 * radius + 1));
+
+		default:
+			CRASH_NOW();
+			break;
+	}
+
+	return Rect3i();
+}
+
+bool VoxelViewRegion::get_row(int y, int z, int &out_min_x, int &out_max_x) const {
+
+	if (is_empty())
+		return false;
+
+	const int dy = y - center.y;
+	const int dz = z - center.z;
+	int half_width;
+
+	switch (shape) {
+
+		case SHAPE_BOX:
+			if (dy < -down || dy >= up || dz < -radius || dz >= radius)
+				return false;
+			out_min_x = center.x - radius;
+			out_max_x = center.x + radius;
+			return true;
+
+		case SHAPE_SPHERE: {
+			int r2 = radius * radius - dy * dy - dz * dz;
+			if (r2 < 0)
+				return false;
+			half_width = isqrt(r2);
+		} break;
+
+		case SHAPE_CYLINDER: {
+			if (dy < -down || dy > up)
+				return false;
+			int r2 = radius * radius - dz * dz;
+			if (r2 < 0)
+				return false;
+			half_width = isqrt(r2);
+		} break;
+
+		default:
+			CRASH_NOW();
+			return false;
+	}
+
+	out_min_x = center.x - half_width;
+	out_max_x = center.x + half_width + 1;
+	return true;
+}
+
+bool VoxelViewRegion::contains(Vector3i pos) const {
+	int min_x, max_x;
+	if (!get_row(pos.y, pos.z, min_x, max_x))
+		return false;
+	return pos.x >= min_x && pos.x < max_x;
+}
+
+void VoxelViewRegion::difference(const VoxelViewRegion &a, const VoxelViewRegion &b, Vector<Rect3i> &out_boxes) {
+
+	if (a.is_empty())
+		return;
+
+	if (a.shape == SHAPE_BOX && b.shape == SHAPE_BOX) {
+		// Cheaper, visits slabs instead of rows
+		Rect3i boxes[Rect3i::MAX_DIFFERENCE_BOXES];
+		int count = Rect3i::difference(a.get_bounds(), b.is_empty() ? Rect3i() : b.get_bounds(), boxes);
+		for (int i = 0; i < count; ++i) {
+			out_boxes.push_back(boxes[i]);
+		}
+		return;
+	}
+
+	const Rect3i bounds = a.get_bounds();
+	const Vector3i end = bounds.pos + bounds.size;
+
+	for (int z = bounds.pos.z; z < end.z; ++z) {
+		for (int y = bounds.pos.y; y < end.y; ++y) {
+
+			int a0, a1;
+			if (!a.get_row(y, z, a0, a1))
+				continue;
+
+			int b0, b1;
+			if (!b.get_row(y, z, b0, b1) || b1 <= a0 || b0 >= a1) {
+				// Rows don't overlap
+				out_boxes.push_back(Rect3i(Vector3i(a0, y, z), Vector3i(a1 - a0, 1, 1)));
+				continue;
+			}
+
+			if (a0 < b0) {
+				out_boxes.push_back(Rect3i(Vector3i(a0, y, z), Vector3i(b0 - a0, 1, 1)));
+			}
+			if (a1 > b1) {
+				out_boxes.push_back(Rect3i(Vector3i(b1, y, z), Vector3i(a1 - b1, 1, 1)));
+			}
+		}
+	}
+}
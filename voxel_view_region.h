@@ -0,0 +1,60 @@
+#ifndef VOXEL_VIEW_REGION_H
+#define VOXEL_VIEW_REGION_H
+
+#include "rect3i.h"
+#include <core/vector.h>
+
+// Area of blocks loaded around a viewer.
+// It is described as rows of blocks along the X axis, which allows to find the difference
+// between two regions without visiting every block they contain.
+struct VoxelViewRegion {
+
+	enum Shape {
+		SHAPE_BOX = 0,
+		// Only uses the radius
+		SHAPE_SPHERE,
+		// Vertical cylinder
+		SHAPE_CYLINDER,
+		SHAPE_COUNT
+	};
+
+	Shape shape;
+	Vector3i center;
+	// Horizontal extent
+	int radius;
+	// Vertical extents, used by boxes and cylinders
+	int up;
+	int down;
+
+	VoxelViewRegion() : shape(SHAPE_BOX), radius(0), up(0), down(0) {}
+
+	VoxelViewRegion(Shape p_shape, Vector3i p_center, int p_radius, int p_up, int p_down)
+		: shape(p_shape), center(p_center), radius(p_radius), up(p_up), down(p_down) {}
+
+	bool is_empty() const {
+		return radius <= 0 || (shape != SHAPE_SPHERE && up + down <= 0);
+	}
+
+	// Box containing all rows of the region
+	Rect3i get_bounds() const;
+
+	// Gets the range of blocks [min_x, max_x[ the region contains at the given Y and Z.
+	// Returns false if there are none.
+	bool get_row(int y, int z, int &out_min_x, int &out_max_x) const;
+
+	bool contains(Vector3i pos) const;
+
+	// Splits the blocks contained in `a` but not in `b` into boxes, without visiting them.
+	// Boxes are appended to `out_boxes`.
+	static void difference(const VoxelViewRegion &a, const VoxelViewRegion &b, Vector<Rect3i> &out_boxes);
+};
+
+inline bool operator==(const VoxelViewRegion &a, const VoxelViewRegion &b) {
+	return a.shape == b.shape && a.center == b.center && a.radius == b.radius && a.up == b.up && a.down == b.down;
+}
+
+inline bool operator!=(const VoxelViewRegion &a, const VoxelViewRegion &b) {
+	return !(a == b);
+}
+
+#endif // VOXEL_VIEW_REGION_H
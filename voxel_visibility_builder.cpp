@@ -0,0 +1,107 @@
+#include "voxel_visibility_builder.h"
+#include <string.h>
+
+// Sides of the area a voxel touches, as a mask of (1 << Cube::Side)
+static inline uint8_t get_touched_sides(int x, int y, int z, const Vector3i &size) {
+	uint8_t sides = 0;
+	if (x == 0)
+		sides |= (1 << Cube::SIDE_RIGHT);
+	if (x == size.x - 1)
+		sides |= (1 << Cube::SIDE_LEFT);
+	if (y == 0)
+		sides |= (1 << Cube::SIDE_BOTTOM);
+	if (y == size.y - 1)
+		sides |= (1 << Cube::SIDE_TOP);
+	if (z == 0)
+		sides |= (1 << Cube::SIDE_BACK);
+	if (z == size.z - 1)
+		sides |= (1 << Cube::SIDE_FRONT);
+	return sides;
+}
+
+uint64_t build_voxel_side_connections(const VoxelBuffer &buffer, unsigned int channel, const VoxelLibrary &library, Vector3i min, Vector3i max,
+		Vector<uint8_t> &temp_visited, Vector<unsigned int> &temp_stack) {
+
+	// When in doubt, nothing gets hidden
+	ERR_FAIL_COND_V(channel >= VoxelBuffer::MAX_CHANNELS, VOXEL_ALL_SIDES_CONNECTED);
+
+	Vector3i::sort_min_max(min, max);
+	min.clamp_to(Vector3i(0, 0, 0), buffer.get_size());
+	max.clamp_to(min, buffer.get_size() + Vector3i(1, 1, 1));
+	const Vector3i size = max - min;
+
+	if (size.x == 0 || size.y == 0 || size.z == 0)
+		return VOXEL_ALL_SIDES_CONNECTED;
+
+	bool see_through[256];
+	see_through[0] = true;
+	for (int type = 1; type < 256; ++type) {
+		see_through[type] = !library.has_voxel(type) || library.get_voxel_const(type).is_transparent();
+	}
+
+	const uint8_t *data = buffer.get_channel_raw(channel);
+
+	if (data == NULL) {
+		// Uniform channel, all sides are connected or none are
+		return see_through[buffer.get_voxel(min, channel)] ? VOXEL_ALL_SIDES_CONNECTED : 0;
+	}
+
+	const unsigned int volume = size.volume();
+	temp_visited.resize(volume);
+	memset(temp_visited.ptrw(), 0, volume * sizeof(uint8_t));
+	// Each voxel is pushed at most once
+	temp_stack.resize(volume);
+	unsigned int *stack_data = temp_stack.ptrw();
+	uint8_t *visited_data = temp_visited.ptrw();
+
+	uint64_t connections = 0;
+
+	// Local indices are in the same [z][x][y] order as VoxelBuffer
+	Vector3i pos;
+	for (pos.z = 0; pos.z < size.z; ++pos.z) {
+		for (pos.x = 0; pos.x < size.x; ++pos.x) {
+			for (pos.y = 0; pos.y < size.y; ++pos.y) {
+
+				const unsigned int seed_index = (pos.z * size.x + pos.x) * size.y + pos.y;
+				if (visited_data[seed_index] || !see_through[data[buffer.index(min.x + pos.x, min.y + pos.y, min.z + pos.z)]])
+					continue;
+
+				// Fill the pocket of see-through voxels containing this one, and gather sides it touches
+				uint8_t sides = 0;
+				unsigned int stack_size = 0;
+				stack_data[stack_size++] = seed_index;
+				visited_data[seed_index] = 1;
+
+				while (stack_size != 0) {
+					const unsigned int i = stack_data[--stack_size];
+					const int y = i % size.y;
+					const int x = (i / size.y) % size.x;
+					const int z = i / (size.y * size.x);
+
+					sides |= get_touched_sides(x, y, z, size);
+
+					for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+						Vector3i npos = Vector3i(x, y, z) + Cube::g_side_normals[side];
+						if (!npos.is_contained_in(Vector3i(0, 0, 0), size))
+							continue;
+						const unsigned int ni = (npos.z * size.x + npos.x) * size.y + npos.y;
+						if (visited_data[ni] || !see_through[data[buffer.index(min.x + npos.x, min.y + npos.y, min.z + npos.z)]])
+							continue;
+						visited_data[ni] = 1;
+						stack_data[stack_size++] = ni;
+					}
+				}
+
+				for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+					if (sides & (1 << side))
+						connections |= (uint64_t)sides << (side * Cube::SIDE_COUNT);
+				}
+
+				if (connections == VOXEL_ALL_SIDES_CONNECTED)
+					return connections;
+			}
+		}
+	}
+
+	return connections;
+}
@@ -0,0 +1,23 @@
+#ifndef VOXEL_VISIBILITY_BUILDER_H
+#define VOXEL_VISIBILITY_BUILDER_H
+
+#include "cube_tables.h"
+#include "voxel_buffer.h"
+#include "voxel_library.h"
+
+// Tells which sides of a block can be seen from which other sides, through voxels that don't hide what's behind them.
+// Bit (a * Cube::SIDE_COUNT + b) is set if sides a and b are connected. It is symmetric.
+// Used to hide blocks the viewer can't see, like caves underground.
+static const uint64_t VOXEL_ALL_SIDES_CONNECTED = (1ull << (Cube::SIDE_COUNT * Cube::SIDE_COUNT)) - 1;
+
+inline bool are_voxel_sides_connected(uint64_t connections, unsigned int side_a, unsigned int side_b) {
+	return (connections & (1ull << (side_a * Cube::SIDE_COUNT + side_b))) != 0;
+}
+
+// Flood fills voxels of the [min, max[ area which are air, transparent or unknown to the library,
+// and returns which sides of the area they connect.
+// `temp_visited` and `temp_stack` are working memory, which can be kept between calls to avoid allocating them each time.
+uint64_t build_voxel_side_connections(const VoxelBuffer &buffer, unsigned int channel, const VoxelLibrary &library, Vector3i min, Vector3i max,
+		Vector<uint8_t> &temp_visited, Vector<unsigned int> &temp_stack);
+
+#endif // VOXEL_VISIBILITY_BUILDER_H
@@ -1,143 +1,343 @@
 #include "zprofiling.h"
 
 #ifdef VOXEL_PROFILING
-#include <core/os/os.h>
 
-//-----------------------------------------------------------------------------
-class ZProfileVar {
-public:
-	static const unsigned int BUFFERED_TIME_COUNT = 100;
+#include <core/os/file_access.h>
+#include <core/sort.h>
 
-	ZProfileVar();
+ZProfiler *ZProfiler::g_singleton = NULL;
+uint32_t ZProfiler::g_generation = 0;
+thread_local ZProfiler::ThreadBuffer *ZProfiler::t_buffer = NULL;
+thread_local uint32_t ZProfiler::t_generation = 0;
+const char *ZProfiler::g_zone_names[ZProfiler::MAX_ZONES];
+uint32_t ZProfiler::g_zone_count = 0;
+Mutex *ZProfiler::g_zones_mutex = NULL;
 
-	void begin(uint64_t time);
-	void end(uint64_t time);
+void ZProfiler::create_singleton() {
+	ERR_FAIL_COND(g_singleton != NULL);
+	g_zones_mutex = Mutex::create();
+	++g_generation;
+	g_singleton = memnew(ZProfiler);
+}
 
-	Dictionary serialize();
+void ZProfiler::destroy_singleton() {
+	ERR_FAIL_COND(g_singleton == NULL);
+	memdelete(g_singleton);
+	g_singleton = NULL;
+	memdelete(g_zones_mutex);
+	g_zones_mutex = NULL;
+}
 
-private:
-	float min_time;
-	float max_time;
-	float total_time;
-	float instant_time;
-	int hits;
-	float buffered_times[BUFFERED_TIME_COUNT];
-	unsigned int buffered_time_index;
+int ZProfiler::get_zone_id(const char *name) {
 
-	float _begin_time;
-};
+	ERR_FAIL_COND_V(name == NULL, -1);
+
+	if (g_zones_mutex)
+		g_zones_mutex->lock();
+
+	int id = -1;
+	for (uint32_t i = 0; i < g_zone_count; ++i) {
+		if (strcmp(g_zone_names[i], name) == 0) {
+			id = i;
+			break;
+		}
+	}
+
+	if (id == -1 && g_zone_count < MAX_ZONES) {
+		id = g_zone_count;
+		g_zone_names[id] = name;
+		++g_zone_count;
+	}
 
-//-----------------------------------------------------------------------------
-inline uint64_t get_time() {
-	return OS::get_singleton()->get_ticks_usec();
-	//return OS::get_singleton()->get_ticks_msec();
+	if (g_zones_mutex)
+		g_zones_mutex->unlock();
+
+	ERR_FAIL_COND_V(id == -1, -1);
+	return id;
 }
 
-ZProfileVar::ZProfileVar() {
-	instant_time = 0.f;
-	min_time = 0.f;
-	max_time = 0.f;
-	total_time = 0.f;
-	hits = 0;
-	_begin_time = 0.f;
-	for (unsigned int i = 0; i < BUFFERED_TIME_COUNT; ++i)
-		buffered_times[i] = 0;
-	buffered_time_index = 0;
+ZProfiler::ZProfiler() {
+	_thread_count = 0;
+	_overflow_reported = false;
+	_threads_mutex = Mutex::create();
+	_read_mutex = Mutex::create();
+	for (int i = 0; i < MAX_THREADS; ++i)
+		_thread_buffers[i] = NULL;
+	memset(_zone_stats, 0, sizeof(_zone_stats));
 }
 
-void ZProfileVar::begin(uint64_t time) {
-	_begin_time = time;
+ZProfiler::~ZProfiler() {
+	for (uint32_t i = 0; i < _thread_count; ++i)
+		memdelete(_thread_buffers[i]);
+	memdelete(_threads_mutex);
+	memdelete(_read_mutex);
 }
 
-void ZProfileVar::end(uint64_t time) {
-	instant_time = time - _begin_time;
+// Reads a value other threads change with atomics
+static _FORCE_INLINE_ uint32_t atomic_read(uint32_t *p) {
+	return atomic_add(p, 0);
+}
 
-	if (hits == 0) {
-		min_time = instant_time;
-		max_time = instant_time;
-	} else {
-		if (instant_time < min_time)
-			min_time = instant_time;
+ZProfiler::ThreadBuffer *ZProfiler::register_thread() {
 
-		if (instant_time > max_time)
-			max_time = instant_time;
-	}
+	MutexLock lock(_threads_mutex);
 
-	total_time += instant_time;
+	ThreadBuffer *buffer = NULL;
 
-	buffered_times[buffered_time_index] = instant_time;
-	++buffered_time_index;
-	if (buffered_time_index >= BUFFERED_TIME_COUNT)
-		buffered_time_index = 0;
+	// Take the buffer of a thread that ended.
+	// Indexes keep going so readers don't see its events twice.
+	for (uint32_t i = 0; i < _thread_count; ++i) {
+		if (_thread_buffers[i]->released) {
+			buffer = _thread_buffers[i];
+			buffer->released = false;
+			buffer->name = NULL;
+			break;
+		}
+	}
 
-	++hits;
-}
+	if (buffer == NULL && _thread_count < MAX_THREADS) {
+		buffer = memnew(ThreadBuffer);
+		buffer->released = false;
+		buffer->name = NULL;
+		buffer->owner_write_index = 0;
+		buffer->write_index = 0;
+		buffer->read_index = 0;
+		_thread_buffers[_thread_count] = buffer;
+		++_thread_count;
+	}
 
-Dictionary ZProfileVar::serialize() {
-	Dictionary d;
-	d["instant_time"] = instant_time;
-	d["min_time"] = min_time;
-	d["max_time"] = max_time;
-	d["mean_time"] = hits > 0 ? total_time / static_cast<float>(hits) : 0;
-	d["total_time"] = total_time;
-	d["hits"] = hits;
-
-	Array a;
-	for (unsigned int i = 0; i < BUFFERED_TIME_COUNT; ++i) {
-		a.append(buffered_times[i]);
+	if (buffer == NULL && !_overflow_reported) {
+		_overflow_reported = true;
+		ERR_PRINTS("ZProfiler can't record more than " + itos(MAX_THREADS) + " threads at once, zones of other threads are ignored");
 	}
-	d["buffered_times"] = a;
-	d["buffered_time_index"] = buffered_time_index;
 
-	return d;
+	t_buffer = buffer;
+	t_generation = g_generation;
+	return buffer;
 }
 
-//-----------------------------------------------------------------------------
-//ZProfiler g_zprofiler;
+void ZProfiler::unregister_thread() {
 
-//ZProfiler & ZProfiler::get() {
-//	return g_zprofiler;
-//}
+	if (t_generation != g_generation)
+		return;
 
-ZProfiler::~ZProfiler() {
-	const String *key = NULL;
-	while (key = _vars.next(key)) {
-		ZProfileVar *v = _vars.get(*key);
-		memdelete(v);
+	if (t_buffer != NULL) {
+		MutexLock lock(_threads_mutex);
+		t_buffer->released = true;
 	}
+
+	// If the thread records again, it gets a buffer again
+	t_buffer = NULL;
+	t_generation = 0;
 }
 
-ZProfileVar *ZProfiler::get_var(String key) {
-	ZProfileVar *v = NULL;
-	ZProfileVar **pv = _vars.getptr(key);
-	if (pv == NULL) {
-		v = memnew(ZProfileVar);
-		_vars[key] = v;
-	} else {
-		v = *pv;
+void ZProfiler::set_thread_name(const char *name) {
+	ThreadBuffer *buffer = get_thread_buffer();
+	if (buffer) {
+		MutexLock lock(_threads_mutex);
+		buffer->name = name;
 	}
-	return v;
 }
 
-void ZProfiler::begin(String key) {
-	ZProfileVar *v = get_var(key);
-	v->begin(get_time());
+uint32_t ZProfiler::get_thread_count() {
+	MutexLock lock(_threads_mutex);
+	return _thread_count;
 }
 
-void ZProfiler::end(String key) {
-	uint64_t time = get_time();
-	ZProfileVar *v = get_var(key);
-	v->end(time);
+void ZProfiler::merge_events() {
+
+	// Must be called with the read mutex locked
+
+	const uint32_t thread_count = get_thread_count();
+
+	for (uint32_t ti = 0; ti < thread_count; ++ti) {
+
+		ThreadBuffer &buffer = *_thread_buffers[ti];
+		const uint32_t write_index = atomic_read(&buffer.write_index);
+
+		// If the reader is too late, the oldest events were overwritten
+		if (write_index - buffer.read_index > EVENT_BUFFER_SIZE)
+			buffer.read_index = write_index - EVENT_BUFFER_SIZE;
+
+		for (uint32_t i = buffer.read_index; i != write_index; ++i) {
+
+			const Event &e = buffer.events[i & (EVENT_BUFFER_SIZE - 1)];
+			if (e.zone_id < 0 || e.zone_id >= MAX_ZONES)
+				continue;
+
+			ZoneStats &stats = _zone_stats[e.zone_id];
+			const uint64_t time = e.end_time - e.begin_time;
+
+			if (stats.hits == 0 || time < stats.min_time)
+				stats.min_time = time;
+			if (time > stats.max_time)
+				stats.max_time = time;
+			stats.total_time += time;
+			stats.instant_time = time;
+			++stats.hits;
+		}
+
+		buffer.read_index = write_index;
+	}
 }
 
-Dictionary ZProfiler::get_all_serialized_info() const {
+Dictionary ZProfiler::get_all_serialized_info() {
+
+	MutexLock lock(_read_mutex);
+	merge_events();
+
 	Dictionary d;
-	const String *key = NULL;
-	while (key = _vars.next(key)) {
-		ZProfileVar *v = _vars.get(*key);
-		d[*key] = v->serialize();
+	for (uint32_t i = 0; i < g_zone_count; ++i) {
+
+		const ZoneStats &stats = _zone_stats[i];
+		if (stats.hits == 0)
+			continue;
+
+		Dictionary zd;
+		zd["instant_time"] = stats.instant_time;
+		zd["min_time"] = stats.min_time;
+		zd["max_time"] = stats.max_time;
+		zd["mean_time"] = stats.total_time / stats.hits;
+		zd["total_time"] = stats.total_time;
+		zd["hits"] = stats.hits;
+
+		d[g_zone_names[i]] = zd;
 	}
+
 	return d;
 }
 
+void ZProfiler::clear() {
+	MutexLock lock(_read_mutex);
+	// Skip events recorded so far
+	merge_events();
+	memset(_zone_stats, 0, sizeof(_zone_stats));
+}
+
+struct _ZProfilerTraceEvent {
+	ZProfiler::Event event;
+	int thread_index;
+};
+
+struct _ZProfilerTraceEventComparator {
+	inline bool operator()(const _ZProfilerTraceEvent &a, const _ZProfilerTraceEvent &b) const {
+		return a.event.begin_time < b.event.begin_time;
+	}
+};
+
+static String get_trace_event_common(const _ZProfilerTraceEvent &te, const char *name, const char *phase, uint64_t time) {
+	return String("{\"name\":\"") + name + "\",\"ph\":\"" + phase + "\",\"pid\":0,\"tid\":" + itos(te.thread_index) + ",\"ts\":" + String::num_uint64(time);
+}
+
+static void store_trace_event(FileAccess *f, bool &first, const String &json) {
+	// Events are separated by commas, without trailing one
+	if (!first)
+		f->store_string(",\n");
+	first = false;
+	f->store_string(json);
+}
+
+Error ZProfiler::save_chrome_trace(const String &path) {
+
+	// Take a copy of events first, so threads can keep writing meanwhile.
+	// Events about to be overwritten are left out since they could change while being copied.
+	const uint32_t margin = 256;
+
+	Vector<_ZProfilerTraceEvent> events;
+	const uint32_t thread_count = get_thread_count();
+
+	for (uint32_t ti = 0; ti < thread_count; ++ti) {
+
+		ThreadBuffer &buffer = *_thread_buffers[ti];
+		const uint32_t write_index = atomic_read(&buffer.write_index);
+		const uint32_t count = MIN(write_index, EVENT_BUFFER_SIZE - margin);
+
+		for (uint32_t i = write_index - count; i != write_index; ++i) {
+			_ZProfilerTraceEvent te;
+			te.event = buffer.events[i & (EVENT_BUFFER_SIZE - 1)];
+			te.thread_index = ti;
+			if (te.event.zone_id >= 0 && te.event.zone_id < MAX_ZONES)
+				events.push_back(te);
+		}
+	}
+
+	SortArray<_ZProfilerTraceEvent, _ZProfilerTraceEventComparator> sorter;
+	sorter.sort(events.ptrw(), events.size());
+
+	// Flows need to know which zone comes last for each ID
+	HashMap<uint64_t, int> remaining_flow_events;
+	for (int i = 0; i < events.size(); ++i) {
+		const uint64_t id = events[i].event.correlation_id;
+		if (id != 0) {
+			int *count = remaining_flow_events.getptr(id);
+			if (count)
+				++(*count);
+			else
+				remaining_flow_events.set(id, 1);
+		}
+	}
+
+	Error err;
+	FileAccess *f = FileAccess::open(path, FileAccess::WRITE, &err);
+	ERR_FAIL_COND_V(f == NULL, err);
+
+	f->store_string("{\"traceEvents\":[\n");
+	bool first = true;
+
+	for (uint32_t ti = 0; ti < thread_count; ++ti) {
+		const char *name;
+		{
+			MutexLock lock(_threads_mutex);
+			name = _thread_buffers[ti]->name;
+		}
+		String thread_name = name != NULL ? String(name) : String("Thread {0}").format(varray(ti));
+		store_trace_event(f, first, String("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":") + itos(ti)
+				+ ",\"args\":{\"name\":\"" + thread_name + "\"}}");
+	}
+
+	HashMap<uint64_t, bool> started_flows;
+
+	for (int i = 0; i < events.size(); ++i) {
+
+		const _ZProfilerTraceEvent &te = events[i];
+		const Event &e = te.event;
+		const char *name = g_zone_names[e.zone_id];
+
+		String line = get_trace_event_common(te, name, "X", e.begin_time) + ",\"dur\":" + String::num_uint64(e.end_time - e.begin_time);
+		if (e.correlation_id != 0) {
+			line += ",\"args\":{\"id\":\"" + String::num_uint64(e.correlation_id, 16) + "\"}";
+		}
+		line += "}";
+		store_trace_event(f, first, line);
+
+		if (e.correlation_id != 0) {
+			int &remaining = remaining_flow_events[e.correlation_id];
+			--remaining;
+
+			const char *phase = NULL;
+			if (!started_flows.has(e.correlation_id)) {
+				if (remaining > 0) {
+					phase = "s";
+					started_flows.set(e.correlation_id, true);
+				}
+			} else {
+				phase = remaining > 0 ? "t" : "f";
+			}
+
+			if (phase != NULL) {
+				// Flow events bind to the zone enclosing their timestamp on the same thread
+				store_trace_event(f, first, get_trace_event_common(te, "block", phase, e.begin_time)
+						+ ",\"cat\":\"block\",\"id\":\"" + String::num_uint64(e.correlation_id, 16) + "\",\"bp\":\"e\"}");
+			}
+		}
+	}
+
+	f->store_string("\n]}\n");
+
+	f->close();
+	memdelete(f);
+
+	return OK;
+}
+
 #endif // VOXEL_PROFILING
@@ -1,40 +1,211 @@
 #ifndef VOXEL_PROFILING_H
 #define VOXEL_PROFILING_H
 
-#define VOXEL_PROFILING
-
+// Profiling is compiled in with the `voxel_profiling=yes` build option.
+// Otherwise the macros below expand to nothing and cost nothing.
 #ifdef VOXEL_PROFILING
 
 #include <core/dictionary.h>
-#include <core/hash_map.h>
-#include <core/ustring.h>
+#include <core/os/mutex.h>
+#include <core/os/os.h>
+#include <core/safe_refcount.h>
+
+#include "vector3i.h"
+
+// Concatenation needs an extra level so __LINE__ gets expanded
+#define _VOXEL_PROFILE_CONCAT2(a, b) a##b
+#define _VOXEL_PROFILE_CONCAT(a, b) _VOXEL_PROFILE_CONCAT2(a, b)
+
+// Times the rest of the enclosing scope. `_name` must be a string literal.
+// The name is looked up only the first time the line runs, then the zone is known by its ID.
+#define VOXEL_PROFILE_SCOPE(_name)                                                                      \
+	static const int _VOXEL_PROFILE_CONCAT(_zprofile_zone_, __LINE__) = ZProfiler::get_zone_id(_name); \
+	ZProfileScope _VOXEL_PROFILE_CONCAT(_zprofile_scope_, __LINE__)(_VOXEL_PROFILE_CONCAT(_zprofile_zone_, __LINE__))
 
-#define VOXEL_PROFILE_BEGIN(_key) _zprofiler.begin(_key);
-#define VOXEL_PROFILE_END(_key) _zprofiler.end(_key);
+// Same as VOXEL_PROFILE_SCOPE, tagging the zone with an ID so related zones can be followed in a timeline
+#define VOXEL_PROFILE_SCOPE_ID(_name, _id)                                                              \
+	static const int _VOXEL_PROFILE_CONCAT(_zprofile_zone_, __LINE__) = ZProfiler::get_zone_id(_name); \
+	ZProfileScope _VOXEL_PROFILE_CONCAT(_zprofile_scope_, __LINE__)(_VOXEL_PROFILE_CONCAT(_zprofile_zone_, __LINE__), _id)
 
-class ZProfileVar;
+// Records a zone of zero duration, to mark when something happened
+#define VOXEL_PROFILE_MARK(_name, _id)                                                                  \
+	{                                                                                                   \
+		static const int _zprofile_zone = ZProfiler::get_zone_id(_name);                               \
+		if (ZProfiler::get_singleton()) {                                                               \
+			const uint64_t _zprofile_time = ZProfiler::get_time();                                      \
+			ZProfiler::get_singleton()->record(_zprofile_zone, _zprofile_time, _zprofile_time, _id);    \
+		}                                                                                               \
+	}
 
+// Times a whole function, using its name
+#define VOXEL_PROFILE_FUNCTION() VOXEL_PROFILE_SCOPE(__FUNCTION__)
+
+// Gives a name to the calling thread in timelines. `_name` must be a string literal.
+#define VOXEL_PROFILE_THREAD_NAME(_name)                        \
+	{                                                           \
+		if (ZProfiler::get_singleton())                         \
+			ZProfiler::get_singleton()->set_thread_name(_name); \
+	}
+
+// Must be called at the end of threads that recorded zones, so their slot can be used by new threads.
+// Their events are kept until overwritten.
+#define VOXEL_PROFILE_THREAD_END()                           \
+	{                                                        \
+		if (ZProfiler::get_singleton())                      \
+			ZProfiler::get_singleton()->unregister_thread(); \
+	}
+
+// Records zones from all threads.
+// Each thread writes timings into its own ring buffer without locking,
+// and buffers are merged into per-zone statistics when they are read.
+// Buffers also keep the latest events of each thread, which can be saved as a timeline.
 class ZProfiler {
 public:
-	//static ZProfiler & get();
-	~ZProfiler();
+	static const int MAX_ZONES = 256;
+	static const int MAX_THREADS = 32;
+	// Must be a power of two
+	static const unsigned int EVENT_BUFFER_SIZE = 16384;
+
+	struct Event {
+		uint64_t begin_time;
+		uint64_t end_time;
+		// Zones having the same ID are linked in timelines. 0 means none.
+		uint64_t correlation_id;
+		int zone_id;
+	};
+
+	static void create_singleton();
+	static void destroy_singleton();
+	static _FORCE_INLINE_ ZProfiler *get_singleton() { return g_singleton; }
+
+	// Returns the ID of a zone from its name. `name` must remain valid for the lifetime of the program.
+	// Returns -1 if no more zones can be registered.
+	static int get_zone_id(const char *name);
+
+	static _FORCE_INLINE_ uint64_t get_time() {
+		return OS::get_singleton()->get_ticks_usec();
+	}
+
+	// Correlation ID following a block through the pipeline, from its request to when it becomes visible
+	static _FORCE_INLINE_ uint64_t get_block_correlation_id(const Vector3i &bpos) {
+		const uint64_t mask = (1 << 21) - 1;
+		return (uint64_t(bpos.x) & mask) | ((uint64_t(bpos.y) & mask) << 21) | ((uint64_t(bpos.z) & mask) << 42) | (uint64_t(1) << 63);
+	}
+
+	_FORCE_INLINE_ void record(int zone_id, uint64_t begin_time, uint64_t end_time, uint64_t correlation_id = 0) {
+		ThreadBuffer *buffer = get_thread_buffer();
+		if (buffer == NULL)
+			return;
+		Event &e = buffer->events[buffer->owner_write_index & (EVENT_BUFFER_SIZE - 1)];
+		e.begin_time = begin_time;
+		e.end_time = end_time;
+		e.correlation_id = correlation_id;
+		e.zone_id = zone_id;
+		++buffer->owner_write_index;
+		// Readers see the event once the published index moved past it
+		atomic_increment(&buffer->write_index);
+	}
+
+	void set_thread_name(const char *name);
+	void unregister_thread();
 
-	void begin(String key);
-	void end(String key);
+	// Statistics of each zone since the last clear(), in microseconds
+	Dictionary get_all_serialized_info();
+	void clear();
 
-	Dictionary get_all_serialized_info() const;
+	// Saves the latest events of all threads in the Chrome trace event format,
+	// which can be opened in chrome://tracing or Perfetto.
+	// Zones sharing a correlation ID are linked with flow arrows.
+	Error save_chrome_trace(const String &path);
 
 private:
-	//ZProfiler();
-	ZProfileVar *get_var(String key);
+	struct ThreadBuffer {
+		// The thread ended, a new one can take the buffer. Protected by the threads mutex.
+		bool released;
+		// Protected by the threads mutex
+		const char *name;
+		// Only accessed by the owner thread
+		uint32_t owner_write_index;
+		// Same as above, published to readers. Only changed with atomics, and read with atomic_read().
+		uint32_t write_index;
+		// Only accessed when reading
+		uint32_t read_index;
+		Event events[EVENT_BUFFER_SIZE];
+	};
 
-	HashMap<String, ZProfileVar *> _vars;
+	struct ZoneStats {
+		uint64_t hits;
+		uint64_t total_time;
+		uint64_t min_time;
+		uint64_t max_time;
+		uint64_t instant_time;
+	};
+
+	ZProfiler();
+	~ZProfiler();
+
+	// Each thread remembers its buffer, so recording doesn't read anything other threads write.
+	// A thread that couldn't get a buffer remembers that too, and doesn't try again.
+	_FORCE_INLINE_ ThreadBuffer *get_thread_buffer() {
+		if (t_generation == g_generation)
+			return t_buffer;
+		return register_thread();
+	}
+
+	ThreadBuffer *register_thread();
+	uint32_t get_thread_count();
+	void merge_events();
+
+	static ZProfiler *g_singleton;
+	// Changes each time the singleton is created, so threads don't use buffers of a previous one
+	static uint32_t g_generation;
+
+	static thread_local ThreadBuffer *t_buffer;
+	static thread_local uint32_t t_generation;
+
+	// Zones are never unregistered, so IDs remain valid
+	static const char *g_zone_names[MAX_ZONES];
+	static uint32_t g_zone_count;
+	static Mutex *g_zones_mutex;
+
+	ThreadBuffer *_thread_buffers[MAX_THREADS];
+	// Buffers are never freed while the profiler exists, so readers can keep using those they know of
+	uint32_t _thread_count;
+	bool _overflow_reported;
+	Mutex *_threads_mutex;
+
+	ZoneStats _zone_stats[MAX_ZONES];
+	Mutex *_read_mutex;
+};
+
+// Records the time spent between its construction and destruction
+class ZProfileScope {
+public:
+	_FORCE_INLINE_ ZProfileScope(int zone_id, uint64_t correlation_id = 0) :
+			_zone_id(zone_id),
+			_correlation_id(correlation_id),
+			_begin_time(ZProfiler::get_time()) {}
+
+	_FORCE_INLINE_ ~ZProfileScope() {
+		ZProfiler *profiler = ZProfiler::get_singleton();
+		if (profiler != NULL && _zone_id >= 0)
+			profiler->record(_zone_id, _begin_time, ZProfiler::get_time(), _correlation_id);
+	}
+
+private:
+	int _zone_id;
+	uint64_t _correlation_id;
+	uint64_t _begin_time;
 };
 
 #else
 
-#define VOXEL_PROFILE_BEGIN(_key) //
-#define VOXEL_PROFILE_END(_key) //
+#define VOXEL_PROFILE_SCOPE(_name)
+#define VOXEL_PROFILE_SCOPE_ID(_name, _id)
+#define VOXEL_PROFILE_MARK(_name, _id)
+#define VOXEL_PROFILE_FUNCTION()
+#define VOXEL_PROFILE_THREAD_NAME(_name)
+#define VOXEL_PROFILE_THREAD_END()
 
 #endif
 